@@ -0,0 +1,127 @@
+// Compares evaluating one expression over many rows with byte_execute_batch()
+// against calling byte_execute_inputs() once per row, and checks that both
+// produce the same values.
+//
+//   cmake --build build --target batch_bench && ./build/batch_bench [rows]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "byte.h"
+
+static const char* inputNames[] = {"price", "quantity", "cost", "active"};
+
+typedef struct {
+  const char* name;
+  const char* source;
+  ByteType resultType;
+} Case;
+
+static const Case cases[] = {
+    {"arith", "price * quantity * 0.9 - cost / 2 + 5", BYTE_NUMBER},
+    {"compare", "(price * quantity - cost) / quantity >= 12.5", BYTE_BOOL},
+    {"bools", "!(price < cost) == active != (quantity > 50)", BYTE_BOOL},
+};
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+static bool sameValue(ByteColumn* column, size_t row, ByteValue value) {
+  if (column->type == BYTE_BOOL) {
+    return value.type == BYTE_BOOL &&
+           column->as.booleans[row] == value.as.boolean;
+  }
+  double expected = value.as.number;
+  double actual = column->as.numbers[row];
+  return value.type == BYTE_NUMBER &&
+         (actual == expected || (isnan(actual) && isnan(expected)));
+}
+
+static void bench(ByteVM* vm, const Case* test, ByteColumn* inputs,
+                  size_t rows) {
+  ByteProgram* program = byte_compile_inputs(test->source, inputNames, 4);
+  if (program == NULL) exit(1);
+
+  ByteColumn result = {.type = test->resultType};
+  result.as.numbers = malloc(rows * sizeof(double));
+
+  // Warm up, then take the best of three runs of each.
+  double batch = 0;
+  for (int run = 0; run < 4; run++) {
+    double start = now();
+    if (byte_execute_batch(vm, program, inputs, rows, &result) != BYTE_OK) {
+      exit(1);
+    }
+    double elapsed = now() - start;
+    if (run == 1 || (run > 1 && elapsed < batch)) batch = elapsed;
+  }
+
+  double scalar = 0;
+  size_t mismatches = 0;
+  for (int run = 0; run < 3; run++) {
+    double start = now();
+    for (size_t row = 0; row < rows; row++) {
+      ByteValue values[4] = {
+          {.type = BYTE_NUMBER, .as.number = inputs[0].as.numbers[row]},
+          {.type = BYTE_NUMBER, .as.number = inputs[1].as.numbers[row]},
+          {.type = BYTE_NUMBER, .as.number = inputs[2].as.numbers[row]},
+          {.type = BYTE_BOOL, .as.boolean = inputs[3].as.booleans[row]},
+      };
+      ByteValue value;
+      byte_execute_inputs(vm, program, values, &value);
+      if (run == 0 && !sameValue(&result, row, value)) mismatches++;
+    }
+    double elapsed = now() - start;
+    if (run == 0 || elapsed < scalar) scalar = elapsed;
+  }
+
+  printf("%-8s scalar %7.1f Mrows/s   batch %7.1f Mrows/s   %5.1fx%s\n",
+         test->name, (double)rows / scalar / 1e6, (double)rows / batch / 1e6,
+         scalar / batch, mismatches == 0 ? "" : "   MISMATCH");
+
+  free(result.as.numbers);
+  byte_free(program);
+}
+
+int main(int argc, const char* argv[]) {
+  size_t rows = argc > 1 ? (size_t)atol(argv[1]) : 4000000;
+
+  double* price = malloc(rows * sizeof(double));
+  double* quantity = malloc(rows * sizeof(double));
+  double* cost = malloc(rows * sizeof(double));
+  bool* active = malloc(rows * sizeof(bool));
+
+  unsigned seed = 1;
+  for (size_t row = 0; row < rows; row++) {
+    seed = seed * 1103515245 + 12345;
+    price[row] = (double)(seed >> 16 & 0xff) / 4;
+    quantity[row] = (double)(seed >> 8 & 0x7f);  // Sometimes 0.
+    cost[row] = (double)(seed >> 4 & 0x3ff);
+    active[row] = seed >> 30 & 1;
+  }
+
+  ByteColumn inputs[4] = {
+      {.type = BYTE_NUMBER, .as.numbers = price},
+      {.type = BYTE_NUMBER, .as.numbers = quantity},
+      {.type = BYTE_NUMBER, .as.numbers = cost},
+      {.type = BYTE_BOOL, .as.booleans = active},
+  };
+
+  ByteVM* vm = byte_new_vm();
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    bench(vm, &cases[i], inputs, rows);
+  }
+  byte_free_vm(vm);
+
+  free(price);
+  free(quantity);
+  free(cost);
+  free(active);
+  return 0;
+}
@@ -0,0 +1,428 @@
+// Times the scanner, the compiler and the VM separately over a generated
+// corpus and prints the results as JSON, so runs from different releases can
+// be compared.
+//
+//   cmake --build build --target bench    # Writes build/bench.json.
+//   ./build/byte_bench [-w warmup] [-r repetitions] [-o file]
+//
+// Every phase of every workload is run `warmup` times untimed and then
+// `repetitions` times timed. The JSON carries the minimum, median and mean of
+// the timed runs in nanoseconds per iteration.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chunk.h"
+#include "compiler.h"
+#include "scanner.h"
+#include "vm.h"
+
+#ifdef DEBUG_TRACE_EXECUTION
+#error "Benchmark a release build; debug builds trace every instruction."
+#endif
+
+static const char* inputNames[] = {"x", "y", "z"};
+
+typedef struct {
+  const char* name;
+  const char* description;
+  char* (*generate)(void);
+  // How many times one timed run of each phase repeats it. Small workloads
+  // repeat more so a run is long enough for the clock.
+  int scanIterations;
+  int compileIterations;
+  int runIterations;
+} Workload;
+
+// A growable string for the generators.
+typedef struct {
+  char* chars;
+  size_t length;
+  size_t capacity;
+} Buffer;
+
+static void append(Buffer* buffer, const char* format, ...) {
+  va_list args;
+  for (;;) {
+    va_start(args, format);
+    size_t room = buffer->capacity - buffer->length;
+    int written = vsnprintf(buffer->chars + buffer->length, room, format, args);
+    va_end(args);
+
+    if ((size_t)written < room) {
+      buffer->length += (size_t)written;
+      return;
+    }
+    buffer->capacity = buffer->capacity < 256 ? 256 : buffer->capacity * 2;
+    buffer->chars = realloc(buffer->chars, buffer->capacity);
+  }
+}
+
+static unsigned nextRandom(unsigned* seed) {
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 8;
+}
+
+// About 8 MiB in one expression of inputs, literals and operators, for the
+// scanner. A newline ends the expression, so it is all one line.
+static char* generateLargeSource(void) {
+  static const char* operators[] = {"+", "-", "*", "/"};
+  Buffer buffer = {NULL, 0, 0};
+  unsigned seed = 1;
+
+  append(&buffer, "x");
+  while (buffer.length < 8 * 1024 * 1024) {
+    unsigned random = nextRandom(&seed);
+    append(&buffer, " %s %s", operators[random % 4],
+           inputNames[(random >> 2) % 3]);
+    append(&buffer, " %s %u.%u", operators[(random >> 4) % 4],
+           (random >> 6) % 1000, (random >> 16) % 10);
+  }
+  append(&buffer, " # %zu bytes", buffer.length);
+  return buffer.chars;
+}
+
+// 2000 levels of parentheses, each holding an operator whose right operand
+// is the next level, for the recursion in the compiler.
+static char* generateDeepNesting(void) {
+  static const char* operators[] = {"+", "-", "*"};
+  Buffer buffer = {NULL, 0, 0};
+
+  for (int level = 0; level < 2000; level++) {
+    append(&buffer, "%s %s (", inputNames[level % 3], operators[level % 3]);
+  }
+  append(&buffer, "x");
+  for (int level = 0; level < 2000; level++) append(&buffer, ")");
+  return buffer.chars;
+}
+
+// 100000 distinct number literals, enough to need OP_CONSTANT_LONG. The
+// expression starts with an input so nothing folds.
+static char* generateManyConstants(void) {
+  Buffer buffer = {NULL, 0, 0};
+
+  append(&buffer, "x");
+  for (int i = 0; i < 100000; i++) append(&buffer, " + %d.25", i);
+  return buffer.chars;
+}
+
+// One long chain of arithmetic on the inputs.
+static char* generateArithmeticChain(void) {
+  static const char* operators[] = {"+", "-", "*", "/"};
+  Buffer buffer = {NULL, 0, 0};
+  unsigned seed = 2;
+
+  append(&buffer, "x");
+  for (int i = 0; i < 200; i++) {
+    unsigned random = nextRandom(&seed);
+    if (random % 3 == 0) {
+      append(&buffer, " %s %u", operators[(random >> 2) % 4],
+             (random >> 4) % 9 + 1);
+    } else {
+      append(&buffer, " %s %s", operators[(random >> 2) % 4],
+             inputNames[(random >> 4) % 3]);
+    }
+  }
+  return buffer.chars;
+}
+
+// One long chain of comparisons and equality tests on the inputs.
+static char* generateComparisonChain(void) {
+  static const char* comparisons[] = {"<", "<=", ">", ">="};
+  static const char* equalities[] = {"==", "!="};
+  Buffer buffer = {NULL, 0, 0};
+  unsigned seed = 3;
+
+  append(&buffer, "x < y");
+  for (int i = 0; i < 100; i++) {
+    unsigned random = nextRandom(&seed);
+    append(&buffer, " %s (%s %s %s - %u)", equalities[random % 2],
+           inputNames[(random >> 1) % 3], comparisons[(random >> 3) % 4],
+           inputNames[(random >> 5) % 3], (random >> 7) % 5);
+  }
+  return buffer.chars;
+}
+
+// 200 globals, each declared from the two before it, then summed.
+static char* generateGlobalChain(void) {
+  Buffer buffer = {NULL, 0, 0};
+
+  append(&buffer, "let g0 = x\nlet g1 = y\n");
+  for (int i = 2; i < 200; i++) {
+    append(&buffer, "let g%d = g%d * 0.5 + g%d - z\n", i, i - 1, i - 2);
+  }
+  append(&buffer, "g0");
+  for (int i = 1; i < 200; i++) append(&buffer, " + g%d", i);
+  append(&buffer, "\n");
+  return buffer.chars;
+}
+
+// The same chain in locals of one block.
+static char* generateLocalChain(void) {
+  Buffer buffer = {NULL, 0, 0};
+
+  append(&buffer, "let sum = 0\n{\n  let l0 = x\n  let l1 = y\n");
+  for (int i = 2; i < 200; i++) {
+    append(&buffer, "  let l%d = l%d * 0.5 + l%d - z\n", i, i - 1, i - 2);
+  }
+  append(&buffer, "  sum = l0");
+  for (int i = 1; i < 200; i++) append(&buffer, " + l%d", i);
+  append(&buffer, "\n}\nsum\n");
+  return buffer.chars;
+}
+
+// A counted loop over the inputs, accumulating in a local.
+static char* generateRangeLoop(void) {
+  Buffer buffer = {NULL, 0, 0};
+
+  append(&buffer, "let total = 0\n{\n  let sum = 0\n");
+  append(&buffer, "  for i in 1..10000 {\n    sum = sum + i * x - y\n  }\n");
+  append(&buffer, "  total = sum\n}\ntotal\n");
+  return buffer.chars;
+}
+
+// Field reads and writes on two instances of one class whose fields were
+// added in different orders. They swap places every iteration, so each site
+// sees both shapes.
+static char* generateFieldAccess(void) {
+  Buffer buffer = {NULL, 0, 0};
+
+  append(&buffer, "class Point {}\nlet total = 0\n{\n");
+  append(&buffer, "  let a = Point()\n  a.x = x\n  a.y = y\n");
+  append(&buffer, "  let b = Point()\n  b.y = y\n  b.x = x\n");
+  append(&buffer, "  let sum = 0\n  for i in 1..10000 {\n");
+  append(&buffer, "    a.x = a.x * 0.5 + b.y\n    sum = sum + a.x - b.x * z\n");
+  append(&buffer, "    let t = a\n    a = b\n    b = t\n  }\n");
+  append(&buffer, "  total = sum\n}\ntotal\n");
+  return buffer.chars;
+}
+
+static const Workload workloads[] = {
+    {"large_source", "8 MiB expression on one line", generateLargeSource,
+     1, 1, 1},
+    {"deep_nesting", "2000 nested parenthesized operands", generateDeepNesting,
+     100, 100, 1000},
+    {"many_constants", "100000 distinct number literals",
+     generateManyConstants, 10, 10, 10},
+    {"arithmetic_chain", "200 arithmetic operators on inputs",
+     generateArithmeticChain, 1000, 1000, 100000},
+    {"comparison_chain", "100 comparisons joined by equality tests",
+     generateComparisonChain, 1000, 1000, 100000},
+    {"global_chain", "200 globals declared from each other, then summed",
+     generateGlobalChain, 1000, 1000, 10000},
+    {"local_chain", "The same chain in the locals of a block",
+     generateLocalChain, 1000, 1000, 10000},
+    {"range_loop", "10000 iterations of a counted loop", generateRangeLoop,
+     10000, 10000, 100},
+    {"field_access", "Fields of two shapes read and written 10000 times",
+     generateFieldAccess, 10000, 10000, 100},
+};
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+// What a phase needs to run once.
+typedef struct {
+  const char* source;
+  Chunk* chunk;
+  VM* vm;
+} Subject;
+
+static size_t scanPhase(Subject* subject) {
+  Scanner scanner;
+  initScanner(&scanner, subject->source);
+
+  size_t tokens = 0;
+  while (scanToken(&scanner).type != TOKEN_EOF) tokens++;
+  return tokens;
+}
+
+static size_t compilePhase(Subject* subject) {
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compileWithInputs(subject->source, &chunk, inputNames, 3)) {
+    fprintf(stderr, "Benchmark source failed to compile.\n");
+    exit(1);
+  }
+  size_t bytes = (size_t)chunk.count;
+  freeChunk(&chunk);
+  return bytes;
+}
+
+static size_t runPhase(Subject* subject) {
+  Value result;
+  if (executeChunk(subject->vm, subject->chunk, &result) != INTERPRET_OK) {
+    fprintf(stderr, "Benchmark chunk failed to run.\n");
+    exit(1);
+  }
+  return 1;
+}
+
+typedef struct {
+  double min;
+  double median;
+  double mean;
+} Summary;
+
+static int compareDoubles(const void* a, const void* b) {
+  double left = *(const double*)a;
+  double right = *(const double*)b;
+  return (left > right) - (left < right);
+}
+
+// Runs phase `iterations` times per sample and summarizes the time of one
+// iteration. Stores what the last iteration returned in work.
+static Summary measure(size_t (*phase)(Subject*), Subject* subject,
+                       int iterations, int warmup, int repetitions,
+                       size_t* work) {
+  for (int run = 0; run < warmup; run++) {
+    for (int i = 0; i < iterations; i++) phase(subject);
+  }
+
+  double* samples = malloc(sizeof(double) * (size_t)repetitions);
+  for (int run = 0; run < repetitions; run++) {
+    double start = now();
+    for (int i = 0; i < iterations; i++) *work = phase(subject);
+    samples[run] = (now() - start) * 1e9 / iterations;
+  }
+
+  qsort(samples, (size_t)repetitions, sizeof(double), compareDoubles);
+  Summary summary = {samples[0], 0, 0};
+  int middle = repetitions / 2;
+  summary.median = repetitions % 2 == 1
+                       ? samples[middle]
+                       : (samples[middle - 1] + samples[middle]) / 2;
+  for (int run = 0; run < repetitions; run++) summary.mean += samples[run];
+  summary.mean /= repetitions;
+
+  free(samples);
+  return summary;
+}
+
+static void printPhase(FILE* out, const char* name, Summary summary,
+                       int iterations, const char* unit, size_t work,
+                       bool last) {
+  fprintf(out,
+          "        \"%s\": {\"iterations\": %d, \"min_ns\": %.1f, "
+          "\"median_ns\": %.1f, \"mean_ns\": %.1f, \"%s\": %zu}%s\n",
+          name, iterations, summary.min, summary.median, summary.mean, unit,
+          work, last ? "" : ",");
+}
+
+static void runWorkload(FILE* out, VM* vm, const Workload* workload,
+                        int warmup, int repetitions, bool last) {
+  char* source = workload->generate();
+
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compileWithInputs(source, &chunk, inputNames, 3)) exit(1);
+
+  Value inputs[] = {NUMBER_VAL(3.5), NUMBER_VAL(-1.25), NUMBER_VAL(8)};
+  vm->inputs = inputs;
+  Subject subject = {source, &chunk, vm};
+
+  size_t tokens = 0;
+  size_t bytes = 0;
+  size_t results = 0;
+  Summary scan = measure(scanPhase, &subject, workload->scanIterations,
+                         warmup, repetitions, &tokens);
+  Summary compile = measure(compilePhase, &subject,
+                            workload->compileIterations, warmup, repetitions,
+                            &bytes);
+  Summary run = measure(runPhase, &subject, workload->runIterations, warmup,
+                        repetitions, &results);
+
+  fprintf(stderr, "%-17s scan %12.0f ns  compile %12.0f ns  run %10.1f ns\n",
+          workload->name, scan.median, compile.median, run.median);
+
+  fprintf(out, "    {\n");
+  fprintf(out, "      \"name\": \"%s\",\n", workload->name);
+  fprintf(out, "      \"description\": \"%s\",\n", workload->description);
+  fprintf(out, "      \"source_bytes\": %zu,\n", strlen(source));
+  fprintf(out, "      \"phases\": {\n");
+  printPhase(out, "scan", scan, workload->scanIterations, "tokens", tokens,
+             false);
+  printPhase(out, "compile", compile, workload->compileIterations,
+             "code_bytes", bytes, false);
+  printPhase(out, "run", run, workload->runIterations, "results", results,
+             true);
+  fprintf(out, "      }\n");
+  fprintf(out, "    }%s\n", last ? "" : ",");
+
+  vm->inputs = NULL;
+  freeChunk(&chunk);
+  free(source);
+}
+
+static void usage() {
+  fprintf(stderr, "Usage: byte_bench [-w warmup] [-r repetitions] [-o file]\n");
+  exit(64);
+}
+
+int main(int argc, const char* argv[]) {
+  int warmup = 1;
+  int repetitions = 5;
+  const char* outputPath = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 == argc) usage();
+    if (strcmp(argv[i], "-w") == 0) {
+      warmup = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-r") == 0) {
+      repetitions = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-o") == 0) {
+      outputPath = argv[++i];
+    } else {
+      usage();
+    }
+  }
+  if (warmup < 0 || repetitions < 1) usage();
+
+  FILE* out = outputPath == NULL ? stdout : fopen(outputPath, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Could not open \"%s\".\n", outputPath);
+    return 74;
+  }
+
+  fprintf(out, "{\n");
+  fprintf(out, "  \"version\": \"%d.%d.%d\",\n", VERSION_MAJOR, VERSION_MINOR,
+          VERSION_PATCH);
+  fprintf(out, "  \"configuration\": {\n");
+#ifdef BYTE_NAN_BOXING
+  fprintf(out, "    \"nan_boxing\": true,\n");
+#else
+  fprintf(out, "    \"nan_boxing\": false,\n");
+#endif
+#ifdef BYTE_COMPUTED_GOTO
+  fprintf(out, "    \"computed_goto\": true,\n");
+#else
+  fprintf(out, "    \"computed_goto\": false,\n");
+#endif
+#ifdef BYTE_JIT
+  fprintf(out, "    \"jit\": true\n");
+#else
+  fprintf(out, "    \"jit\": false\n");
+#endif
+  fprintf(out, "  },\n");
+  fprintf(out, "  \"warmup\": %d,\n", warmup);
+  fprintf(out, "  \"repetitions\": %d,\n", repetitions);
+  fprintf(out, "  \"benchmarks\": [\n");
+
+  VM* vm = newVM();
+  size_t count = sizeof(workloads) / sizeof(workloads[0]);
+  for (size_t i = 0; i < count; i++) {
+    runWorkload(out, vm, &workloads[i], warmup, repetitions, i + 1 == count);
+  }
+  freeVM(vm);
+
+  fprintf(out, "  ]\n");
+  fprintf(out, "}\n");
+  if (out != stdout) fclose(out);
+  return 0;
+}
@@ -0,0 +1,158 @@
+// Measures garbage collection pauses under an allocation-heavy program, once
+// with major collections stopping the VM and once with them marking
+// concurrently, and prints the pause percentiles of each.
+//
+//   cmake --build build --target gc_bench && ./build/gc_bench [steps]
+//
+// The program builds a ring of nodes, each with two children and a payload,
+// that soon fills the old generation. Every step then mutates the node it
+// is at while the collector may be marking: it gives the node a new payload,
+// which makes an old object point into the nursery, and swaps the node's
+// skip reference with its neighbor's, which drops references the marker may
+// not have reached yet. A temporary dies right away.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "compiler.h"
+#include "memory.h"
+#include "vm.h"
+
+#define LIVE 100000
+
+static const char* source =
+    "class Node {}\n"
+    "let head = Node()\n"
+    "head.id = 0\n"
+    "head.left = Node()\n"
+    "head.right = Node()\n"
+    "head.skip = head\n"
+    "head.payload = Node()\n"
+    "head.payload.value = 0\n"
+    "let tail = head\n"
+    "for i in 1..%d {\n"
+    "  let node = Node()\n"
+    "  node.id = i\n"
+    "  node.left = Node()\n"
+    "  node.left.value = i\n"
+    "  node.right = Node()\n"
+    "  node.right.value = 0 - i\n"
+    "  node.skip = node\n"
+    "  node.payload = Node()\n"
+    "  node.payload.value = 0\n"
+    "  tail.next = node\n"
+    "  tail = node\n"
+    "}\n"
+    "tail.next = head\n"
+    "let node = head\n"
+    "for step in 1..%ld {\n"
+    "  node.payload = Node()\n"
+    "  node.payload.value = step\n"
+    "  let skip = node.skip\n"
+    "  node.skip = node.next.skip\n"
+    "  node.next.skip = skip\n"
+    "  Node().value = step\n"
+    "  node = node.next\n"
+    "}\n"
+    "let sum = 0\n"
+    "for i in 1..%d {\n"
+    "  sum = sum + node.payload.value + node.skip.id\n"
+    "  node = node.next\n"
+    "}\n"
+    "sum\n";
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+static int compareCounts(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+static double percentile(uint64_t* sorted, int count, double fraction) {
+  int index = (int)(fraction * count + 0.999999) - 1;
+  if (index < 0) index = 0;
+  return (double)sorted[index] / 1000.0;
+}
+
+// The sum the program returns: the last step to visit each node, which is
+// its payload, and the ids, which the swaps only permute.
+static double expectedSum(long steps) {
+  double sum = 0;
+  for (long node = 0; node < LIVE; node++) {
+    long visits = steps < node + 1 ? 0 : (steps - node - 1) / LIVE + 1;
+    if (visits > 0) sum += (double)(node + 1 + (visits - 1) * LIVE);
+    sum += (double)node;
+  }
+  return sum;
+}
+
+static void run(const char* mode, bool concurrent, long steps) {
+  char program[2048];
+  snprintf(program, sizeof(program), source, LIVE - 1, steps, LIVE);
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(program, &chunk)) exit(1);
+
+  VM* vm = newVM();
+  setConcurrentGC(vm, concurrent);
+  vm->heap.recordPauses = true;
+
+  double start = now();
+  Value result;
+  if (executeChunk(vm, &chunk, &result) != INTERPRET_OK) exit(1);
+  double elapsed = now() - start;
+
+  // A collector that lost or moved a live object wrongly shows up here.
+  if (!IS_NUMBER(result) || AS_NUMBER(result) != expectedSum(steps)) {
+    fprintf(stderr, "%s: the program returned the wrong sum\n", mode);
+    exit(1);
+  }
+
+  Heap* heap = &vm->heap;
+  uint64_t* pauses = heap->pauses;
+  int count = heap->pauseCount;
+  qsort(pauses, count, sizeof(uint64_t), compareCounts);
+  uint64_t total = 0;
+  for (int i = 0; i < count; i++) total += pauses[i];
+
+  printf("%-12s %7d %6llu %8.1f %8.1f %8.1f %8.1f %8.1f %9.1f %7.2f\n", mode,
+         count, (unsigned long long)heap->majorCollections,
+         percentile(pauses, count, 0.5), percentile(pauses, count, 0.9),
+         percentile(pauses, count, 0.99), percentile(pauses, count, 0.999),
+         count > 0 ? (double)pauses[count - 1] / 1000.0 : 0.0,
+         (double)total / 1e6, elapsed);
+
+  freeVM(vm);
+  freeChunk(&chunk);
+}
+
+int main(int argc, char* argv[]) {
+  long steps = argc > 1 ? atol(argv[1]) : 2000000;
+
+  printf("%ld steps over a ring of %d nodes\n", steps, LIVE);
+  printf("%-12s %7s %6s %8s %8s %8s %8s %8s %9s %7s\n", "mode", "pauses",
+         "major", "p50 us", "p90 us", "p99 us", "p99.9 us", "max us",
+         "total ms", "run s");
+  // Each mode gets a fresh process, since the first leaves malloc's free
+  // lists fragmented for the second.
+  const char* modes[] = {"stop-world", "concurrent"};
+  for (int i = 0; i < 2; i++) {
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+      run(modes[i], i == 1, steps);
+      exit(0);
+    }
+    int status;
+    if (child < 0 || waitpid(child, &status, 0) < 0 || status != 0) return 1;
+  }
+  return 0;
+}
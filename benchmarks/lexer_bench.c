@@ -0,0 +1,147 @@
+// Measures scanner throughput on a large generated source file.
+//
+//   cmake --build build --target lexer_bench && ./build/lexer_bench [MiB]
+//
+// BYTE_SCANNER_SIMD=scalar|sse2 pins the scanner to a narrower search.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "scanner.h"
+
+static const char* names[] = {
+    "count", "total", "index", "value", "result", "name",    "item",
+    "left",  "right", "node",  "user",  "config", "timeout", "limit",
+};
+
+static const char* reservedWords[] = {
+    "let", "if", "else", "for", "in", "while", "return", "and", "or",
+    "not", "nil", "true", "false", "func", "class", "this", "print",
+};
+
+// Builds roughly `size` bytes of bare identifiers and keywords, the tokens
+// whose cost is dominated by keyword recognition.
+static char* generateWords(size_t size) {
+  char* source = malloc(size + 256);
+  size_t length = 0;
+  unsigned seed = 1;
+
+  while (length < size) {
+    seed = seed * 1103515245 + 12345;
+    const char* word = (seed >> 30) == 0 ? reservedWords[(seed >> 16) % 17]
+                                         : names[(seed >> 8) % 14];
+    length += sprintf(source + length, "%s ", word);
+  }
+
+  return source;
+}
+
+// Builds roughly `size` bytes of statements mixing identifiers, keywords,
+// numbers, operators, strings and comments.
+static char* generateSource(size_t size) {
+  char* source = malloc(size + 256);
+  size_t length = 0;
+  unsigned seed = 1;
+
+  while (length < size) {
+    seed = seed * 1103515245 + 12345;
+    const char* id = names[(seed >> 8) % 14];
+    const char* keyword = reservedWords[(seed >> 16) % 17];
+    int number = (int)((seed >> 4) % 1000);
+
+    switch ((seed >> 24) % 4) {
+      case 0:
+        length += sprintf(source + length, "let %s_%d = %s + %d * (%s - 1)\n",
+                          id, number, id, number, id);
+        break;
+      case 1:
+        length += sprintf(source + length, "%s %s >= %d.5 { %s(\"%s\") }\n",
+                          keyword, id, number, id, keyword);
+        break;
+      case 2:
+        length += sprintf(source + length, "# %s %s %d\n", keyword, id, number);
+        break;
+      default:
+        length += sprintf(source + length, "%s.%s != %s and %s <= %d\n", id,
+                          keyword, id, keyword, number);
+        break;
+    }
+  }
+
+  return source;
+}
+
+// Builds roughly `size` bytes of indented lines carrying long comments and
+// string literals, where the scanner spends its time skipping plain text.
+static char* generateText(size_t size) {
+  static const char* prose =
+      "the quick brown fox jumps over the lazy dog while the scanner watches";
+  char* source = malloc(size + 512);
+  size_t length = 0;
+  unsigned seed = 1;
+
+  while (length < size) {
+    seed = seed * 1103515245 + 12345;
+    const char* id = names[(seed >> 8) % 14];
+    int indent = (int)((seed >> 16) % 5) * 4;
+
+    if ((seed >> 24) % 2 == 0) {
+      length += sprintf(source + length, "%*s# %s: %s\n", indent, "", id,
+                        prose);
+    } else {
+      length += sprintf(source + length, "%*s%s = \"%s, %s\"\n", indent, "",
+                        id, prose, prose);
+    }
+  }
+
+  return source;
+}
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+static size_t scanAll(const char* source) {
+  Scanner scanner;
+  initScanner(&scanner, source);
+
+  size_t tokens = 0;
+  for (;;) {
+    Token token = scanToken(&scanner);
+    if (token.type == TOKEN_EOF) break;
+    tokens++;
+  }
+  return tokens;
+}
+
+static void bench(const char* name, char* source, size_t megabytes) {
+  // Warm up caches and page in the buffer.
+  size_t tokens = scanAll(source);
+
+  double best = 0;
+  for (int run = 0; run < 5; run++) {
+    double start = now();
+    scanAll(source);
+    double elapsed = now() - start;
+    if (run == 0 || elapsed < best) best = elapsed;
+  }
+
+  printf("%-6s %zu MiB, %zu tokens: %.1f Mtokens/s, %.1f MiB/s\n", name,
+         megabytes, tokens, (double)tokens / best / 1e6,
+         (double)megabytes / best);
+  free(source);
+}
+
+int main(int argc, const char* argv[]) {
+  size_t megabytes = argc > 1 ? (size_t)atoi(argv[1]) : 16;
+  size_t size = megabytes * 1024 * 1024;
+
+  bench("mixed", generateSource(size), megabytes);
+  bench("words", generateWords(size), megabytes);
+  bench("text", generateText(size), megabytes);
+  return 0;
+}
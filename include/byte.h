@@ -0,0 +1,125 @@
+#ifndef BYTE_H
+#define BYTE_H
+
+// Embedding API. Compile an expression once with byte_compile() and run it as
+// often as needed with byte_execute(). A VM's stack, globals and property
+// caches only grow when a program needs more than earlier ones did. The
+// objects a program creates live in the VM's nursery and old generation,
+// which its garbage collector manages.
+//
+//   ByteVM* vm = byte_new_vm();
+//   ByteProgram* program = byte_compile("1 + 2 * 3");
+//   ByteValue result;
+//   if (program != NULL && byte_execute(vm, program, &result) == BYTE_OK) {
+//     printf("%g\n", result.as.number);
+//   }
+//   byte_free(program);
+//   byte_free_vm(vm);
+//
+// A VM runs one program at a time. Use one VM per thread.
+//
+// Strings in compiled programs, literals and names alike, are interned once
+// for the whole process and shared by every program that uses them. Each is
+// freed along with the last program using it.
+//
+// Programs compiled with byte_compile_inputs() read their identifiers from
+// inputs given at execution time, either one row of values or whole columns
+// with byte_execute_batch(), which runs vectorized over blocks of rows.
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define BYTE_API __attribute__((visibility("default")))
+#else
+#define BYTE_API
+#endif
+
+typedef struct ByteVM ByteVM;
+typedef struct ByteProgram ByteProgram;
+
+typedef enum {
+  BYTE_NIL,
+  BYTE_BOOL,
+  BYTE_NUMBER,
+  BYTE_STRING,  // Only ever a result.
+} ByteType;
+
+typedef struct {
+  ByteType type;
+  union {
+    bool boolean;
+    double number;
+    // Owned by the VM that returned it, and valid until that VM runs again
+    // or is freed with byte_free_vm().
+    struct {
+      const char* chars;  // NUL-terminated.
+      size_t length;
+    } string;
+  } as;
+} ByteValue;
+
+// A column of `rows` values of one type. BYTE_NIL columns have no data, and
+// there are no BYTE_STRING columns.
+typedef struct {
+  ByteType type;
+  union {
+    bool* booleans;
+    double* numbers;
+  } as;
+} ByteColumn;
+
+typedef enum {
+  BYTE_OK,
+  BYTE_RUNTIME_ERROR,
+} ByteResult;
+
+BYTE_API ByteVM* byte_new_vm(void);
+BYTE_API void byte_free_vm(ByteVM* vm);
+
+// Marks vm's objects on a background thread instead of stopping vm for the
+// whole of a major collection, trading throughput for shorter pauses. Has no
+// effect unless built with BYTE_NAN_BOXING.
+BYTE_API void byte_set_concurrent_gc(ByteVM* vm, bool concurrent);
+
+// Returns NULL after reporting the errors on stderr if source does not
+// compile.
+BYTE_API ByteProgram* byte_compile(const char* source);
+
+// Like byte_compile(), with the identifier names[i] reading input i. At most
+// 256 names.
+BYTE_API ByteProgram* byte_compile_inputs(const char* source,
+                                          const char* const* names, int count);
+
+// Runs program and stores the value of its last statement in result, nil if
+// that declares a variable. Globals start out undefined on every run. On a
+// runtime error the message goes to stderr and result is left untouched.
+// Returning an instance or a class is a runtime error.
+BYTE_API ByteResult byte_execute(ByteVM* vm, ByteProgram* program,
+                                 ByteValue* result);
+
+// byte_execute() for a program with inputs, one value per input name. Inputs
+// cannot be strings.
+BYTE_API ByteResult byte_execute_inputs(ByteVM* vm, ByteProgram* program,
+                                        const ByteValue* inputs,
+                                        ByteValue* result);
+
+// Evaluates program for each of `rows` rows, taking input i from inputs[i]
+// and writing each row's value into result. The caller sets result's type to
+// what the program produces and provides room for `rows` values.
+BYTE_API ByteResult byte_execute_batch(ByteVM* vm, ByteProgram* program,
+                                       const ByteColumn* inputs, size_t rows,
+                                       ByteColumn* result);
+
+// Accepts NULL.
+BYTE_API void byte_free(ByteProgram* program);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,161 @@
+// Implements the embedding API in include/byte.h on top of the compiler and
+// VM. ByteVM is the internal VM under another name; ByteProgram owns a chunk.
+
+#include "byte.h"
+
+#include <stdio.h>
+
+#include "compiler/batch.h"
+#include "compiler/compiler.h"
+#include "compiler/vm.h"
+#include "utils/memory.h"
+
+struct ByteProgram {
+  Chunk chunk;
+  int inputCount;
+};
+
+ByteVM* byte_new_vm(void) { return (ByteVM*)newVM(); }
+
+void byte_free_vm(ByteVM* vm) { freeVM((VM*)vm); }
+
+void byte_set_concurrent_gc(ByteVM* vm, bool concurrent) {
+  setConcurrentGC((VM*)vm, concurrent);
+}
+
+ByteProgram* byte_compile(const char* source) {
+  return byte_compile_inputs(source, NULL, 0);
+}
+
+ByteProgram* byte_compile_inputs(const char* source, const char* const* names,
+                                 int count) {
+  if (count < 0 || count > MAX_INPUTS) {
+    fprintf(stderr, "Programs take at most %d inputs.\n", MAX_INPUTS);
+    return NULL;
+  }
+
+  ByteProgram* program = ALLOCATE(ByteProgram, 1);
+  initChunk(&program->chunk);
+  program->inputCount = count;
+
+  if (!compileWithInputs(source, &program->chunk, names, count)) {
+    byte_free(program);
+    return NULL;
+  }
+  return program;
+}
+
+static Value importValue(ByteValue value) {
+  switch (value.type) {
+    case BYTE_BOOL:
+      return BOOL_VAL(value.as.boolean);
+    case BYTE_NUMBER:
+      return NUMBER_VAL(value.as.number);
+    default:
+      return NIL_VAL;
+  }
+}
+
+// Returns false if value has no ByteValue equivalent. A string is handed out
+// in place, since the VM keeps it until it next runs.
+static bool exportValue(Value value, ByteValue* exported) {
+  if (IS_NIL(value)) {
+    exported->type = BYTE_NIL;
+  } else if (IS_BOOL(value)) {
+    exported->type = BYTE_BOOL;
+    exported->as.boolean = AS_BOOL(value);
+  } else if (IS_NUMBER(value)) {
+    exported->type = BYTE_NUMBER;
+    exported->as.number = AS_NUMBER(value);
+  } else if (IS_STRING(value)) {
+    exported->type = BYTE_STRING;
+    exported->as.string.chars = AS_CSTRING(value);
+    exported->as.string.length = (size_t)AS_STRING(value)->length;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+ByteResult byte_execute(ByteVM* vm, ByteProgram* program, ByteValue* result) {
+  if (program->inputCount > 0) {
+    fprintf(stderr, "Program expects %d inputs.\n", program->inputCount);
+    return BYTE_RUNTIME_ERROR;
+  }
+  return byte_execute_inputs(vm, program, NULL, result);
+}
+
+ByteResult byte_execute_inputs(ByteVM* vm, ByteProgram* program,
+                               const ByteValue* inputs, ByteValue* result) {
+  Value values[MAX_INPUTS];
+  for (int i = 0; i < program->inputCount; i++) {
+    if (inputs[i].type == BYTE_STRING) {
+      fprintf(stderr, "Inputs cannot be strings.\n");
+      return BYTE_RUNTIME_ERROR;
+    }
+    values[i] = importValue(inputs[i]);
+  }
+
+  VM* machine = (VM*)vm;
+  machine->inputs = values;
+  Value value;
+  InterpretResult status = executeChunk(machine, &program->chunk, &value);
+  machine->inputs = NULL;
+
+  if (status != INTERPRET_OK) return BYTE_RUNTIME_ERROR;
+  if (!exportValue(value, result)) {
+    fprintf(stderr, "Can only return nil, booleans, numbers and strings.\n");
+    return BYTE_RUNTIME_ERROR;
+  }
+  return BYTE_OK;
+}
+
+static ColumnType columnType(ByteType type) {
+  switch (type) {
+    case BYTE_BOOL:
+      return COLUMN_BOOL;
+    case BYTE_NUMBER:
+      return COLUMN_NUMBER;
+    default:
+      return COLUMN_NIL;
+  }
+}
+
+static Column importColumn(const ByteColumn* column) {
+  Column imported;
+  imported.type = columnType(column->type);
+  if (imported.type == COLUMN_BOOL) {
+    imported.as.bools = column->as.booleans;
+  } else {
+    imported.as.numbers = column->as.numbers;
+  }
+  return imported;
+}
+
+ByteResult byte_execute_batch(ByteVM* vm, ByteProgram* program,
+                              const ByteColumn* inputs, size_t rows,
+                              ByteColumn* result) {
+  Column columns[MAX_INPUTS];
+  for (int i = 0; i < program->inputCount; i++) {
+    if (inputs[i].type == BYTE_STRING) {
+      fprintf(stderr, "Columns cannot be strings.\n");
+      return BYTE_RUNTIME_ERROR;
+    }
+    columns[i] = importColumn(&inputs[i]);
+  }
+  if (result->type == BYTE_STRING) {
+    fprintf(stderr, "Columns cannot be strings.\n");
+    return BYTE_RUNTIME_ERROR;
+  }
+
+  Column output = importColumn(result);
+  InterpretResult status = executeBatch((VM*)vm, &program->chunk, columns,
+                                        program->inputCount, rows, &output);
+  return status == INTERPRET_OK ? BYTE_OK : BYTE_RUNTIME_ERROR;
+}
+
+void byte_free(ByteProgram* program) {
+  if (program == NULL) return;
+  freeChunk(&program->chunk);
+  FREE(ByteProgram, program);
+}
@@ -0,0 +1,564 @@
+#include "batch.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "memory.h"
+
+// Evaluates a chunk over a block of rows at a time instead of one row at a
+// time. Every input column has a single type, so the type of each stack slot
+// is the same for all rows and can be worked out once from the bytecode. The
+// chunk is translated into a list of kernels over registers holding
+// BATCH_ROWS lanes each, and each kernel runs over a whole block with GCC
+// vector arithmetic.
+//
+// Chunks the translation does not handle, including the ones that would
+// raise a type error, run through the ordinary VM row by row instead. That
+// also gives type errors the same message as a scalar run.
+
+#define BATCH_ROWS 256
+#define BATCH_LANES 4
+#define BATCH_VECTORS (BATCH_ROWS / BATCH_LANES)
+
+typedef double NumberVector __attribute__((vector_size(32)));
+// Booleans are lane masks: all bits set for true, clear for false. This is
+// what vector comparisons produce.
+typedef int64_t MaskVector __attribute__((vector_size(32)));
+
+typedef union {
+  NumberVector numbers[BATCH_VECTORS];
+  MaskVector masks[BATCH_VECTORS];
+} Register;
+
+typedef enum {
+  KERNEL_LOAD_NUMBER,  // dst = input column a
+  KERNEL_LOAD_BOOL,
+  KERNEL_ADD,
+  KERNEL_SUBTRACT,
+  KERNEL_MULTIPLY,
+  KERNEL_DIVIDE,
+  KERNEL_NEGATE,
+  KERNEL_LESS,
+  KERNEL_GREATER,
+  KERNEL_NOT_LESS,
+  KERNEL_NOT_GREATER,
+  KERNEL_EQUAL_NUMBER,
+  KERNEL_NOT_EQUAL_NUMBER,
+  KERNEL_EQUAL_BOOL,
+  KERNEL_NOT_EQUAL_BOOL,
+  KERNEL_NOT,
+} Kernel;
+
+typedef struct {
+  uint8_t kernel;
+  uint16_t dst;
+  uint16_t a;
+  uint16_t b;
+} BatchOp;
+
+// Where a stack slot lives while translating. Slots of type COLUMN_NIL have
+// no register. Constants are numbered apart from the stack slots, with
+// CONSTANT_REGISTER set, until the stack size is known.
+typedef struct {
+  ColumnType type;
+  int reg;
+} Slot;
+
+#define NO_REGISTER -1
+#define UNSUPPORTED -2
+#define CONSTANT_REGISTER 0x8000
+
+typedef struct {
+  BatchOp* ops;
+  int opCount;
+  int opCapacity;
+
+  // Registers [0, stackSize) hold the stack slot of the same depth. The ones
+  // above hold the constants, filled once when the plan is built.
+  Register* registers;
+  int registerCount;
+  int stackSize;
+
+  Slot result;
+} Plan;
+
+static void emitOp(Plan* plan, Kernel kernel, int dst, int a, int b) {
+  if (plan->opCapacity < plan->opCount + 1) {
+    int oldCapacity = plan->opCapacity;
+    plan->opCapacity = GROW_CAPACITY(oldCapacity);
+    plan->ops = GROW_ARRAY(BatchOp, plan->ops, oldCapacity, plan->opCapacity);
+  }
+  plan->ops[plan->opCount++] =
+      (BatchOp){(uint8_t)kernel, (uint16_t)dst, (uint16_t)a, (uint16_t)b};
+}
+
+// Constants are collected while translating and copied into their registers
+// once the register file has been allocated.
+typedef struct {
+  ColumnType type;
+  Value value;
+} Constant;
+
+typedef struct {
+  Constant* constants;
+  int count;
+  int capacity;
+} ConstantList;
+
+static int addBatchConstant(ConstantList* list, ColumnType type,
+                            Value value) {
+  if (list->count == CONSTANT_REGISTER) return UNSUPPORTED;
+
+  if (list->capacity < list->count + 1) {
+    int oldCapacity = list->capacity;
+    list->capacity = GROW_CAPACITY(oldCapacity);
+    list->constants =
+        GROW_ARRAY(Constant, list->constants, oldCapacity, list->capacity);
+  }
+  list->constants[list->count] = (Constant){type, value};
+  return CONSTANT_REGISTER | list->count++;
+}
+
+static Slot constantSlot(ConstantList* list, Value value) {
+  if (IS_NUMBER(value)) {
+    return (Slot){COLUMN_NUMBER, addBatchConstant(list, COLUMN_NUMBER, value)};
+  }
+  if (IS_BOOL(value)) {
+    return (Slot){COLUMN_BOOL, addBatchConstant(list, COLUMN_BOOL, value)};
+  }
+  if (IS_NIL(value)) return (Slot){COLUMN_NIL, NO_REGISTER};
+  return (Slot){COLUMN_NIL, UNSUPPORTED};
+}
+
+static bool numberOperands(Slot a, Slot b) {
+  return a.type == COLUMN_NUMBER && b.type == COLUMN_NUMBER;
+}
+
+// Translates `a == b`, or `a != b` when `negate` is set, into depth.
+static void translateEqual(Plan* plan, ConstantList* constants, Slot* slots,
+                           int depth, bool negate) {
+  Slot a = slots[depth];
+  Slot b = slots[depth + 1];
+
+  if (a.type != b.type || a.type == COLUMN_NIL) {
+    // Decided by the types alone: nil equals nil, mixed types never match.
+    bool equal = a.type == b.type;
+    slots[depth] = constantSlot(constants, BOOL_VAL(equal != negate));
+    return;
+  }
+
+  Kernel kernel;
+  if (a.type == COLUMN_NUMBER) {
+    kernel = negate ? KERNEL_NOT_EQUAL_NUMBER : KERNEL_EQUAL_NUMBER;
+  } else {
+    kernel = negate ? KERNEL_NOT_EQUAL_BOOL : KERNEL_EQUAL_BOOL;
+  }
+  emitOp(plan, kernel, depth, a.reg, b.reg);
+  slots[depth] = (Slot){COLUMN_BOOL, depth};
+}
+
+// Emits `depth = a op b` for two numbers, leaving a slot of resultType.
+static bool translateBinary(Plan* plan, Slot* slots, int depth, Kernel kernel,
+                            ColumnType resultType) {
+  if (!numberOperands(slots[depth], slots[depth + 1])) return false;
+  emitOp(plan, kernel, depth, slots[depth].reg, slots[depth + 1].reg);
+  slots[depth] = (Slot){resultType, depth};
+  return true;
+}
+
+static Kernel constKernel(uint8_t instruction) {
+  switch (instruction) {
+    case OP_ADD_CONST:
+      return KERNEL_ADD;
+    case OP_SUBTRACT_CONST:
+      return KERNEL_SUBTRACT;
+    case OP_MULTIPLY_CONST:
+      return KERNEL_MULTIPLY;
+    default:
+      return KERNEL_DIVIDE;
+  }
+}
+
+// Turns the provisional constant numbering into register indices.
+static int resolveRegister(Plan* plan, int reg) {
+  if (reg < 0 || !(reg & CONSTANT_REGISTER)) return reg;
+  return plan->stackSize + (reg & ~CONSTANT_REGISTER);
+}
+
+// Works out the type of every stack slot and emits the kernels for chunk.
+// Returns false if some instruction cannot run as a batch.
+static bool translate(Plan* plan, ConstantList* constants, Chunk* chunk,
+                      const Column* inputs, int inputCount) {
+  // The stack never holds more slots than there are instructions.
+  int maxDepth = chunk->count + 1;
+  Slot* slots = ALLOCATE(Slot, maxDepth);
+
+  int depth = 0;
+  int deepest = 0;
+  bool ok = false;
+
+  for (int offset = 0; offset < chunk->count;) {
+    // The chunk may already have been quickened by the interpreter.
+    uint8_t instruction = unquickened(loadOpcode(&chunk->code[offset]));
+    uint8_t* operand = &chunk->code[offset + 1];
+    offset += 1 + opInfo[instruction].operandBytes;
+
+    switch (instruction) {
+      case OP_CONSTANT:
+        slots[depth] =
+            constantSlot(constants, chunk->constants.values[operand[0]]);
+        if (slots[depth++].reg == UNSUPPORTED) goto done;
+        break;
+      case OP_CONSTANT_LONG: {
+        int index = (operand[0] << 16) | (operand[1] << 8) | operand[2];
+        slots[depth] = constantSlot(constants, chunk->constants.values[index]);
+        if (slots[depth++].reg == UNSUPPORTED) goto done;
+        break;
+      }
+      case OP_NIL:
+        slots[depth++] = (Slot){COLUMN_NIL, NO_REGISTER};
+        break;
+      case OP_TRUE:
+      case OP_FALSE:
+        slots[depth] =
+            constantSlot(constants, BOOL_VAL(instruction == OP_TRUE));
+        if (slots[depth++].reg == UNSUPPORTED) goto done;
+        break;
+      case OP_GET_INPUT: {
+        if (operand[0] >= inputCount) goto done;
+        ColumnType type = inputs[operand[0]].type;
+        if (type == COLUMN_NUMBER) {
+          emitOp(plan, KERNEL_LOAD_NUMBER, depth, operand[0], 0);
+        } else if (type == COLUMN_BOOL) {
+          emitOp(plan, KERNEL_LOAD_BOOL, depth, operand[0], 0);
+        }
+        slots[depth] = (Slot){type, type == COLUMN_NIL ? NO_REGISTER : depth};
+        depth++;
+        break;
+      }
+      case OP_EQUAL:
+      case OP_NOT_EQUAL:
+        depth--;
+        translateEqual(plan, constants, slots, depth - 1,
+                       instruction == OP_NOT_EQUAL);
+        if (slots[depth - 1].reg == UNSUPPORTED) goto done;
+        break;
+
+#define BINARY(opcode, kernel, type)                              \
+  case opcode:                                                    \
+    depth--;                                                      \
+    if (!translateBinary(plan, slots, depth - 1, kernel, type)) { \
+      goto done;                                                  \
+    }                                                             \
+    break;
+        BINARY(OP_ADD, KERNEL_ADD, COLUMN_NUMBER)
+        BINARY(OP_SUBTRACT, KERNEL_SUBTRACT, COLUMN_NUMBER)
+        BINARY(OP_MULTIPLY, KERNEL_MULTIPLY, COLUMN_NUMBER)
+        BINARY(OP_DIVIDE, KERNEL_DIVIDE, COLUMN_NUMBER)
+        BINARY(OP_LESS, KERNEL_LESS, COLUMN_BOOL)
+        BINARY(OP_GREATER, KERNEL_GREATER, COLUMN_BOOL)
+        BINARY(OP_GREATER_EQUAL, KERNEL_NOT_LESS, COLUMN_BOOL)
+        BINARY(OP_LESS_EQUAL, KERNEL_NOT_GREATER, COLUMN_BOOL)
+#undef BINARY
+
+      case OP_ADD_CONST:
+      case OP_SUBTRACT_CONST:
+      case OP_MULTIPLY_CONST:
+      case OP_DIVIDE_CONST:
+        // The constant takes the slot above the other operand.
+        slots[depth] =
+            constantSlot(constants, chunk->constants.values[operand[0]]);
+        if (!translateBinary(plan, slots, depth - 1, constKernel(instruction),
+                             COLUMN_NUMBER)) {
+          goto done;
+        }
+        break;
+      case OP_NOT: {
+        Slot a = slots[depth - 1];
+        if (a.type == COLUMN_BOOL) {
+          emitOp(plan, KERNEL_NOT, depth - 1, a.reg, 0);
+          slots[depth - 1] = (Slot){COLUMN_BOOL, depth - 1};
+        } else {
+          // nil is falsy and numbers never are.
+          slots[depth - 1] =
+              constantSlot(constants, BOOL_VAL(a.type == COLUMN_NIL));
+          if (slots[depth - 1].reg == UNSUPPORTED) goto done;
+        }
+        break;
+      }
+      case OP_NEGATE: {
+        Slot a = slots[depth - 1];
+        if (a.type != COLUMN_NUMBER) goto done;
+        emitOp(plan, KERNEL_NEGATE, depth - 1, a.reg, 0);
+        slots[depth - 1] = (Slot){COLUMN_NUMBER, depth - 1};
+        break;
+      }
+      case OP_RETURN:
+        plan->result = slots[depth - 1];
+        ok = true;
+        goto done;
+      default:
+        goto done;
+    }
+
+    if (depth > deepest) deepest = depth;
+  }
+
+done:
+  FREE_ARRAY(Slot, slots, maxDepth);
+  if (!ok || deepest >= CONSTANT_REGISTER ||
+      deepest + constants->count > UINT16_MAX) {
+    return false;
+  }
+
+  plan->stackSize = deepest;
+  for (int i = 0; i < plan->opCount; i++) {
+    BatchOp* op = &plan->ops[i];
+    op->dst = (uint16_t)resolveRegister(plan, op->dst);
+    if (op->kernel != KERNEL_LOAD_NUMBER && op->kernel != KERNEL_LOAD_BOOL) {
+      op->a = (uint16_t)resolveRegister(plan, op->a);
+      op->b = (uint16_t)resolveRegister(plan, op->b);
+    }
+  }
+  plan->result.reg = resolveRegister(plan, plan->result.reg);
+  return true;
+}
+
+static void freePlan(Plan* plan) {
+  FREE_ARRAY(BatchOp, plan->ops, plan->opCapacity);
+  free(plan->registers);
+}
+
+// Builds the plan for running chunk over columns of the given types.
+static bool buildPlan(Plan* plan, Chunk* chunk, const Column* inputs,
+                      int inputCount) {
+  plan->ops = NULL;
+  plan->opCount = 0;
+  plan->opCapacity = 0;
+  plan->registers = NULL;
+
+  ConstantList constants = {NULL, 0, 0};
+  bool ok = translate(plan, &constants, chunk, inputs, inputCount);
+
+  if (ok) {
+    // Vector loads and stores need the registers 32-byte aligned, which
+    // reallocate() does not promise.
+    plan->registerCount = plan->stackSize + constants.count;
+    plan->registers = (Register*)aligned_alloc(
+        _Alignof(Register), sizeof(Register) * plan->registerCount);
+    ok = plan->registers != NULL;
+  }
+
+  if (ok) {
+    // Lanes past the last row of a short block are computed on but never
+    // read, so they only need to hold harmless values.
+    memset(plan->registers, 0, sizeof(Register) * plan->stackSize);
+
+    for (int i = 0; i < constants.count; i++) {
+      Register* reg = &plan->registers[plan->stackSize + i];
+      Constant* constant = &constants.constants[i];
+      for (int v = 0; v < BATCH_VECTORS; v++) {
+        if (constant->type == COLUMN_NUMBER) {
+          double number = AS_NUMBER(constant->value);
+          reg->numbers[v] = (NumberVector){number, number, number, number};
+        } else {
+          int64_t mask = AS_BOOL(constant->value) ? -1 : 0;
+          reg->masks[v] = (MaskVector){mask, mask, mask, mask};
+        }
+      }
+    }
+  }
+
+  FREE_ARRAY(Constant, constants.constants, constants.capacity);
+  if (!ok) freePlan(plan);
+  return ok;
+}
+
+// Runs every kernel of plan over `count` rows starting at row `start`.
+static void runBlock(Plan* plan, const Column* inputs, size_t start,
+                     size_t count) {
+  Register* registers = plan->registers;
+
+  for (int i = 0; i < plan->opCount; i++) {
+    BatchOp* op = &plan->ops[i];
+    Register* dst = &registers[op->dst];
+    Register* a = &registers[op->a];
+    Register* b = &registers[op->b];
+
+    switch (op->kernel) {
+      case KERNEL_LOAD_NUMBER:
+        memcpy(dst->numbers, inputs[op->a].as.numbers + start,
+               count * sizeof(double));
+        break;
+      case KERNEL_LOAD_BOOL: {
+        const bool* column = inputs[op->a].as.bools + start;
+        int64_t* lanes = (int64_t*)dst->masks;
+        for (size_t row = 0; row < count; row++) {
+          lanes[row] = column[row] ? -1 : 0;
+        }
+        break;
+      }
+
+#define NUMBER_KERNEL(kernel, expression)        \
+  case kernel:                                   \
+    for (int v = 0; v < BATCH_VECTORS; v++) {    \
+      NumberVector x = a->numbers[v];            \
+      NumberVector y = b->numbers[v];            \
+      (void)y;                                   \
+      dst->numbers[v] = (expression);            \
+    }                                            \
+    break;
+#define COMPARE_KERNEL(kernel, expression)       \
+  case kernel:                                   \
+    for (int v = 0; v < BATCH_VECTORS; v++) {    \
+      NumberVector x = a->numbers[v];            \
+      NumberVector y = b->numbers[v];            \
+      dst->masks[v] = (MaskVector)(expression);  \
+    }                                            \
+    break;
+#define MASK_KERNEL(kernel, expression)          \
+  case kernel:                                   \
+    for (int v = 0; v < BATCH_VECTORS; v++) {    \
+      MaskVector x = a->masks[v];                \
+      MaskVector y = b->masks[v];                \
+      (void)y;                                   \
+      dst->masks[v] = (expression);              \
+    }                                            \
+    break;
+
+      NUMBER_KERNEL(KERNEL_ADD, x + y)
+      NUMBER_KERNEL(KERNEL_SUBTRACT, x - y)
+      NUMBER_KERNEL(KERNEL_MULTIPLY, x * y)
+      NUMBER_KERNEL(KERNEL_DIVIDE, x / y)
+      NUMBER_KERNEL(KERNEL_NEGATE, -x)
+      // The negated forms match the VM, which also negates the opposite
+      // comparison, so NaN compares the same way.
+      COMPARE_KERNEL(KERNEL_LESS, x < y)
+      COMPARE_KERNEL(KERNEL_GREATER, x > y)
+      COMPARE_KERNEL(KERNEL_NOT_LESS, ~(x < y))
+      COMPARE_KERNEL(KERNEL_NOT_GREATER, ~(x > y))
+      COMPARE_KERNEL(KERNEL_EQUAL_NUMBER, x == y)
+      COMPARE_KERNEL(KERNEL_NOT_EQUAL_NUMBER, ~(x == y))
+      MASK_KERNEL(KERNEL_EQUAL_BOOL, ~(x ^ y))
+      MASK_KERNEL(KERNEL_NOT_EQUAL_BOOL, x ^ y)
+      MASK_KERNEL(KERNEL_NOT, ~x)
+
+#undef NUMBER_KERNEL
+#undef COMPARE_KERNEL
+#undef MASK_KERNEL
+    }
+  }
+}
+
+static void storeBlock(Plan* plan, Column* result, size_t start,
+                       size_t count) {
+  if (plan->result.type == COLUMN_NIL) return;
+
+  Register* reg = &plan->registers[plan->result.reg];
+  if (plan->result.type == COLUMN_NUMBER) {
+    memcpy(result->as.numbers + start, reg->numbers, count * sizeof(double));
+    return;
+  }
+
+  const int64_t* lanes = (const int64_t*)reg->masks;
+  for (size_t row = 0; row < count; row++) {
+    result->as.bools[start + row] = lanes[row] != 0;
+  }
+}
+
+static bool storeValue(Column* result, size_t row, Value value) {
+  switch (result->type) {
+    case COLUMN_NIL:
+      return IS_NIL(value);
+    case COLUMN_BOOL:
+      if (!IS_BOOL(value)) return false;
+      result->as.bools[row] = AS_BOOL(value);
+      return true;
+    case COLUMN_NUMBER:
+      if (!IS_NUMBER(value)) return false;
+      result->as.numbers[row] = AS_NUMBER(value);
+      return true;
+  }
+  return false;
+}
+
+static const char* columnTypeName(ColumnType type) {
+  switch (type) {
+    case COLUMN_NIL:
+      return "nil";
+    case COLUMN_BOOL:
+      return "bool";
+    default:
+      return "number";
+  }
+}
+
+static void resultTypeError(ColumnType expected) {
+  fprintf(stderr, "Result column expects a %s.\n", columnTypeName(expected));
+}
+
+// The row at a time fallback.
+static InterpretResult executeRows(VM* vm, Chunk* chunk, const Column* inputs,
+                                   int inputCount, size_t rows,
+                                   Column* result) {
+  Value values[MAX_INPUTS];
+  const Value* savedInputs = vm->inputs;
+  vm->inputs = values;
+
+  InterpretResult status = INTERPRET_OK;
+  for (size_t row = 0; row < rows && status == INTERPRET_OK; row++) {
+    for (int i = 0; i < inputCount; i++) {
+      switch (inputs[i].type) {
+        case COLUMN_NIL:
+          values[i] = NIL_VAL;
+          break;
+        case COLUMN_BOOL:
+          values[i] = BOOL_VAL(inputs[i].as.bools[row]);
+          break;
+        case COLUMN_NUMBER:
+          values[i] = NUMBER_VAL(inputs[i].as.numbers[row]);
+          break;
+      }
+    }
+
+    Value value;
+    status = executeChunk(vm, chunk, &value);
+    if (status == INTERPRET_OK && !storeValue(result, row, value)) {
+      resultTypeError(result->type);
+      status = INTERPRET_RUNTIME_ERROR;
+    }
+  }
+
+  vm->inputs = savedInputs;
+  return status;
+}
+
+// Evaluates chunk once for each of `rows` rows, reading OP_GET_INPUT slot i
+// from inputs[i] and writing the value of each row into result, whose type
+// must match what the chunk produces. vm is only used for chunks that cannot
+// be vectorized.
+InterpretResult executeBatch(VM* vm, Chunk* chunk, const Column* inputs,
+                             int inputCount, size_t rows, Column* result) {
+  Plan plan;
+  if (rows == 0 || vm->profile != NULL ||
+      !buildPlan(&plan, chunk, inputs, inputCount)) {
+    return executeRows(vm, chunk, inputs, inputCount, rows, result);
+  }
+
+  if (plan.result.type != result->type) {
+    freePlan(&plan);
+    resultTypeError(result->type);
+    return INTERPRET_RUNTIME_ERROR;
+  }
+
+  for (size_t start = 0; start < rows; start += BATCH_ROWS) {
+    size_t count = rows - start < BATCH_ROWS ? rows - start : BATCH_ROWS;
+    runBlock(&plan, inputs, start, count);
+    storeBlock(&plan, result, start, count);
+  }
+
+  freePlan(&plan);
+  return INTERPRET_OK;
+}
@@ -0,0 +1,27 @@
+#ifndef BYTE_BATCH_H
+#define BYTE_BATCH_H
+
+#include <stddef.h>
+
+#include "chunk.h"
+#include "vm.h"
+
+typedef enum {
+  COLUMN_NIL,
+  COLUMN_BOOL,
+  COLUMN_NUMBER,
+} ColumnType;
+
+// One value per row. A nil column carries no data.
+typedef struct {
+  ColumnType type;
+  union {
+    bool* bools;
+    double* numbers;
+  } as;
+} Column;
+
+InterpretResult executeBatch(VM* vm, Chunk* chunk, const Column* inputs,
+                             int inputCount, size_t rows, Column* result);
+
+#endif
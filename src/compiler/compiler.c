@@ -2,19 +2,23 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "chunk.h"
 #include "common.h"
+#include "memory.h"
+#include "object.h"
+#include "peephole.h"
 #include "scanner.h"
+#include "table.h"
 #include "value.h"
+#include "verifier.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
 #endif
 
-Chunk* compilingChunk;
-
-static Chunk* currentChunk() { return compilingChunk; }
+static Chunk* currentChunk(Parser* parser) { return parser->chunk; }
 
 static void errorAt(Parser* parser, Token* token, const char* message,
                     va_list args) {
@@ -53,8 +57,19 @@ static void errorAtCurrent(Parser* parser, const char* message, ...) {
   va_end(args);
 }
 
-static void error(Parser* parser, const char* message) {
-  errorAt(parser, &parser->previous, message, NULL);
+static void error(Parser* parser, const char* message, ...) {
+  va_list args;
+  va_start(args, message);
+  errorAt(parser, &parser->previous, message, args);
+  va_end(args);
+}
+
+static void errorAtToken(Parser* parser, Token* token, const char* message,
+                         ...) {
+  va_list args;
+  va_start(args, message);
+  errorAt(parser, token, message, args);
+  va_end(args);
 }
 
 static void advance(Parser* parser) {
@@ -62,7 +77,7 @@ static void advance(Parser* parser) {
 
   while (true) {
     parser->current = scanToken(parser->scanner);
-    if (parser->current.type != TOKEN_EOF) break;
+    if (parser->current.type != TOKEN_ERROR) break;
     errorAtCurrent(parser, parser->current.start);
   }
 }
@@ -76,8 +91,22 @@ static void consume(Parser* parser, TokenType type, const char* message) {
   errorAtCurrent(parser, message);
 }
 
+static bool check(Parser* parser, TokenType type) {
+  return parser->current.type == type;
+}
+
+static bool match(Parser* parser, TokenType type) {
+  if (!check(parser, type)) return false;
+  advance(parser);
+  return true;
+}
+
+static bool atSeparator(Parser* parser) {
+  return check(parser, TOKEN_NEWLINE) || check(parser, TOKEN_SEMICOLON);
+}
+
 void emitByte(Parser* parser, uint8_t byte) {
-  writeChunk(currentChunk(), byte, parser->previous.line);
+  writeChunk(currentChunk(parser), byte, parser->previous.line);
 }
 
 void emitBytes(Parser* parser, uint8_t byte1, uint8_t byte2) {
@@ -87,18 +116,165 @@ void emitBytes(Parser* parser, uint8_t byte1, uint8_t byte2) {
 
 static void emitReturn(Parser* parser) { emitByte(parser, OP_RETURN); }
 
-static uint8_t makeConstant(Parser* parser, Value value) {
-  int constant = addConstant(currentChunk(), value);
-  if (constant > UINT8_MAX) {
+// Passes the caller's reference to a string value on to the chunk.
+static int makeConstant(Parser* parser, Value value) {
+  Value existing;
+  if (tableGet(&parser->constantIndex, value, &existing)) {
+    // The chunk holds a reference to it already.
+    if (IS_STRING(value)) releaseString(AS_STRING(value));
+    return (int)AS_NUMBER(existing);
+  }
+
+  int constant = addConstant(currentChunk(parser), value);
+  if (constant >= MAX_CONSTANTS) {
     error(parser, "Too many constants in one chunk.");
     return 0;
   }
 
-  return (uint8_t)constant;
+  tableSet(&parser->constantIndex, value, NUMBER_VAL(constant));
+  return constant;
+}
+
+static void emitConstant(Parser* parser, Value value) {
+  int constant = makeConstant(parser, value);
+  if (constant <= UINT8_MAX) {
+    emitBytes(parser, OP_CONSTANT, (uint8_t)constant);
+    return;
+  }
+
+  emitByte(parser, OP_CONSTANT_LONG);
+  emitByte(parser, (uint8_t)(constant >> 16));
+  emitByte(parser, (uint8_t)(constant >> 8));
+  emitByte(parser, (uint8_t)constant);
+}
+
+// Throws away code and constants emitted since the given offsets.
+static void discardCode(Parser* parser, int codeStart, int constantStart) {
+  Chunk* chunk = currentChunk(parser);
+  for (int i = constantStart; i < chunk->constants.count; i++) {
+    tableDelete(&parser->constantIndex, chunk->constants.values[i]);
+  }
+  rewindChunk(chunk, codeStart, constantStart);
 }
 
 static void endCompiler(Parser* parser) { emitReturn(parser); }
 
+// Reads the value loaded by the code in [start, end) if that code is exactly
+// one literal instruction.
+static bool readLiteral(Chunk* chunk, int start, int end, Value* value) {
+  if (end - start == 1) {
+    switch (chunk->code[start]) {
+      case OP_NIL:
+        *value = NIL_VAL;
+        return true;
+      case OP_TRUE:
+        *value = BOOL_VAL(true);
+        return true;
+      case OP_FALSE:
+        *value = BOOL_VAL(false);
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  if (end - start == 2 && chunk->code[start] == OP_CONSTANT) {
+    *value = chunk->constants.values[chunk->code[start + 1]];
+    return true;
+  }
+
+  if (end - start == 4 && chunk->code[start] == OP_CONSTANT_LONG) {
+    uint8_t* operand = &chunk->code[start + 1];
+    *value = chunk->constants
+                 .values[(operand[0] << 16) | (operand[1] << 8) | operand[2]];
+    return true;
+  }
+
+  return false;
+}
+
+static void emitLiteral(Parser* parser, Value value) {
+  if (IS_NIL(value)) {
+    emitByte(parser, OP_NIL);
+  } else if (IS_BOOL(value)) {
+    emitByte(parser, AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+  } else {
+    emitConstant(parser, value);
+  }
+}
+
+// Computes what run() would leave on the stack for `a op b`. Operations that
+// would raise a runtime error are not folded so the error still happens.
+static bool foldBinary(TokenType operatorType, Value a, Value b,
+                       Value* result) {
+  switch (operatorType) {
+    case TOKEN_EQUAL_EQUAL:
+      *result = BOOL_VAL(valuesEqual(a, b));
+      return true;
+    case TOKEN_BANG_EQUAL:
+      *result = BOOL_VAL(!valuesEqual(a, b));
+      return true;
+    case TOKEN_PLUS:
+      if (IS_STRING(a) && IS_STRING(b)) {
+        *result = OBJ_VAL(concatenateStrings(AS_STRING(a), AS_STRING(b)));
+        return true;
+      }
+      break;
+    default:
+      break;
+  }
+
+  if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+
+  double x = AS_NUMBER(a);
+  double y = AS_NUMBER(b);
+
+  // >= and <= compile to a negated < and >, which differs from the direct
+  // comparison when either side is NaN.
+  switch (operatorType) {
+    case TOKEN_GREATER_THAN:
+      *result = BOOL_VAL(x > y);
+      return true;
+    case TOKEN_GREATER_EQUAL:
+      *result = BOOL_VAL(!(x < y));
+      return true;
+    case TOKEN_LESS_THAN:
+      *result = BOOL_VAL(x < y);
+      return true;
+    case TOKEN_LESS_EQUAL:
+      *result = BOOL_VAL(!(x > y));
+      return true;
+    case TOKEN_PLUS:
+      *result = NUMBER_VAL(x + y);
+      return true;
+    case TOKEN_MINUS:
+      *result = NUMBER_VAL(x - y);
+      return true;
+    case TOKEN_STAR:
+      *result = NUMBER_VAL(x * y);
+      return true;
+    case TOKEN_SLASH:
+      *result = NUMBER_VAL(x / y);
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool foldUnary(TokenType operatorType, Value operand, Value* result) {
+  switch (operatorType) {
+    case TOKEN_BANG:
+      *result = BOOL_VAL(isFalsy(operand));
+      return true;
+    case TOKEN_MINUS:
+      if (!IS_NUMBER(operand)) return false;
+      *result = NUMBER_VAL(-AS_NUMBER(operand));
+      return true;
+    default:
+      return false;
+  }
+}
+
 // forward declaration
 static void expression(Parser* parser);
 static ParseRule* getRule(TokenType type);
@@ -107,10 +283,23 @@ static void parsePrecedence(Parser* parser, Precedence precedence);
 
 static void binary(Parser* parser) {
   TokenType operatorType = parser->previous.type;
+  int leftStart = parser->operandStart;
+  int leftConstants = parser->operandConstants;
+  int rightStart = currentChunk(parser)->count;
 
   ParseRule* rule = getRule(operatorType);
   parsePrecedence(parser, (Precedence)(rule->precedence + 1));
 
+  Chunk* chunk = currentChunk(parser);
+  Value a, b, result;
+  if (readLiteral(chunk, leftStart, rightStart, &a) &&
+      readLiteral(chunk, rightStart, chunk->count, &b) &&
+      foldBinary(operatorType, a, b, &result)) {
+    discardCode(parser, leftStart, leftConstants);
+    emitLiteral(parser, result);
+    return;
+  }
+
   switch (operatorType) {
     case TOKEN_BANG_EQUAL:
       emitBytes(parser, OP_EQUAL, OP_NOT);
@@ -168,21 +357,191 @@ static void grouping(Parser* parser) {
   consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
 }
 
-static void emitConstant(Parser* parser, Value value) {
-  emitBytes(parser, OP_CONSTANT, makeConstant(parser, value));
-}
-
 static void number(Parser* parser) {
   double value = strtod(parser->previous.start, NULL);
   emitConstant(parser, NUMBER_VAL(value));
 }
 
+// Compiles a string literal without interpolation. The token includes the
+// quotes.
+static void string(Parser* parser) {
+  const char* source = parser->previous.start + 1;
+  int length = parser->previous.length - 2;
+
+  char* chars = ALLOCATE(char, length + 1);
+  int count = 0;
+  for (int i = 0; i < length; i++) {
+    if (source[i] != '\\' || i + 1 == length) {
+      chars[count++] = source[i];
+      continue;
+    }
+
+    switch (source[++i]) {
+      case 'n':
+        chars[count++] = '\n';
+        break;
+      case 't':
+        chars[count++] = '\t';
+        break;
+      case 'r':
+        chars[count++] = '\r';
+        break;
+      case '\\':
+      case '"':
+      case '\'':
+      case '$':
+        chars[count++] = source[i];
+        break;
+      default:
+        // Not an escape, keep the backslash.
+        chars[count++] = '\\';
+        chars[count++] = source[i];
+        break;
+    }
+  }
+
+  emitConstant(parser, OBJ_VAL(copyString(chars, count)));
+  FREE_ARRAY(char, chars, length + 1);
+}
+
+static bool identifiersEqual(Token* a, Token* b) {
+  return a->length == b->length && memcmp(a->start, b->start, a->length) == 0;
+}
+
+// The index of the input called name, or -1.
+static int inputSlot(Parser* parser, Token* name) {
+  for (int i = 0; i < parser->inputCount; i++) {
+    const char* inputName = parser->inputNames[i];
+    if ((int)strlen(inputName) == name->length &&
+        memcmp(inputName, name->start, name->length) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// The slot of the innermost local called name, or -1.
+static int localSlot(Parser* parser, Token* name) {
+  for (int i = parser->localCount - 1; i >= 0; i--) {
+    Local* local = &parser->locals[i];
+    if (identifiersEqual(&local->name, name)) {
+      if (local->depth == -1) {
+        error(parser, "Can't read local variable in its own initializer.");
+      }
+      return i;
+    }
+  }
+  return -1;
+}
+
+// The slot of the global called name, allocated on first mention. Whether a
+// let declares it is only known at the end of the chunk.
+static int globalSlot(Parser* parser, Token* name) {
+  for (int i = 0; i < parser->globalCount; i++) {
+    if (identifiersEqual(&parser->globals[i].name, name)) return i;
+  }
+
+  if (parser->globalCount == MAX_GLOBALS) {
+    errorAtToken(parser, name, "Too many global variables in one chunk.");
+    return 0;
+  }
+
+  Global* global = &parser->globals[parser->globalCount];
+  global->name = *name;
+  global->declared = false;
+  writeValueArray(&currentChunk(parser)->globals,
+                  OBJ_VAL(copyString(name->start, name->length)));
+  return parser->globalCount++;
+}
+
+static void variable(Parser* parser) {
+  Token name = parser->previous;
+  int local = localSlot(parser, &name);
+  if (local != -1) {
+    if (parser->canAssign && match(parser, TOKEN_EQUAL)) {
+      expression(parser);
+      emitBytes(parser, OP_SET_LOCAL, (uint8_t)local);
+      return;
+    }
+    emitBytes(parser, OP_GET_LOCAL, (uint8_t)local);
+    return;
+  }
+
+  int input = inputSlot(parser, &name);
+  if (input != -1) {
+    // Inputs are read-only; parsePrecedence() rejects an `=` after them.
+    emitBytes(parser, OP_GET_INPUT, (uint8_t)input);
+    return;
+  }
+
+  int slot = globalSlot(parser, &name);
+  if (parser->canAssign && match(parser, TOKEN_EQUAL)) {
+    expression(parser);
+    emitBytes(parser, OP_SET_GLOBAL, (uint8_t)slot);
+    return;
+  }
+  emitBytes(parser, OP_GET_GLOBAL, (uint8_t)slot);
+}
+
+// The site of a new property access, naming the property it reads or
+// writes. Every access gets a site of its own, so each has its own cache.
+static int propertySite(Parser* parser, Token* name) {
+  ValueArray* properties = &currentChunk(parser)->properties;
+  if (properties->count == MAX_PROPERTY_SITES) {
+    error(parser, "Too many property accesses in one chunk.");
+    return 0;
+  }
+
+  writeValueArray(properties, OBJ_VAL(copyString(name->start, name->length)));
+  return properties->count - 1;
+}
+
+static void dot(Parser* parser) {
+  consume(parser, TOKEN_IDENTIFIER, "Expect property name after '.'.");
+  Token name = parser->previous;
+  int site = propertySite(parser, &name);
+
+  if (parser->canAssign && match(parser, TOKEN_EQUAL)) {
+    expression(parser);
+    emitByte(parser, OP_SET_PROPERTY);
+  } else {
+    emitByte(parser, OP_GET_PROPERTY);
+  }
+  emitBytes(parser, (uint8_t)(site >> 8), (uint8_t)site);
+}
+
+static void call(Parser* parser) {
+  int argCount = 0;
+  if (!check(parser, TOKEN_RIGHT_PAREN)) {
+    do {
+      expression(parser);
+      if (argCount == UINT8_MAX) {
+        error(parser, "Can't have more than 255 arguments.");
+      }
+      argCount++;
+    } while (match(parser, TOKEN_COMMA));
+  }
+  consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+  emitBytes(parser, OP_CALL, (uint8_t)argCount);
+}
+
 static void unary(Parser* parser) {
   TokenType operatorType = parser->previous.type;
+  int operandStart = currentChunk(parser)->count;
+  int operandConstants = currentChunk(parser)->constants.count;
 
   // compile the operand
   parsePrecedence(parser, PREC_UNARY);
 
+  Chunk* chunk = currentChunk(parser);
+  Value operand, result;
+  if (readLiteral(chunk, operandStart, chunk->count, &operand) &&
+      foldUnary(operatorType, operand, &result)) {
+    discardCode(parser, operandStart, operandConstants);
+    emitLiteral(parser, result);
+    return;
+  }
+
   switch (operatorType) {
     case TOKEN_MINUS:
       emitByte(parser, OP_NEGATE);
@@ -201,6 +560,9 @@ static void expression(Parser* parser) {
 }
 
 static void parsePrecedence(Parser* parser, Precedence precedence) {
+  int start = currentChunk(parser)->count;
+  int constants = currentChunk(parser)->constants.count;
+
   advance(parser);
   ParseFn prefixRule = getRule(parser->previous.type)->prefix;
 
@@ -208,17 +570,254 @@ static void parsePrecedence(Parser* parser, Precedence precedence) {
     errorAtCurrent(parser, "Expect expression.");
     return;
   }
+  bool canAssign = precedence <= PREC_ASSIGNMENT;
+  parser->canAssign = canAssign;
   prefixRule(parser);
 
   while (precedence <= getRule(parser->current.type)->precedence) {
     advance(parser);
     ParseFn infixRule = getRule(parser->previous.type)->infix;
+    parser->operandStart = start;
+    parser->operandConstants = constants;
+    // An operand parsed since may have changed it.
+    parser->canAssign = canAssign;
     infixRule(parser);
   }
+
+  // Nothing before the `=` consumed it, so it is not a variable.
+  if (canAssign && match(parser, TOKEN_EQUAL)) {
+    error(parser, "Invalid assignment target.");
+  }
+}
+
+// Adds a local for name in the current block. It cannot be read until
+// markInitialized().
+static void declareLocal(Parser* parser, Token* name) {
+  for (int i = parser->localCount - 1; i >= 0; i--) {
+    Local* local = &parser->locals[i];
+    if (local->depth != -1 && local->depth < parser->scopeDepth) break;
+    if (identifiersEqual(&local->name, name)) {
+      error(parser, "Already a variable with this name in this scope.");
+    }
+  }
+
+  if (parser->localCount == MAX_LOCALS) {
+    error(parser, "Too many local variables in one chunk.");
+    return;
+  }
+
+  Local* local = &parser->locals[parser->localCount++];
+  local->name = *name;
+  local->depth = -1;
+}
+
+static void markInitialized(Parser* parser) {
+  if (parser->localCount == 0) return;
+  parser->locals[parser->localCount - 1].depth = parser->scopeDepth;
+}
+
+// Declares a variable called name in the current block, or checks that it
+// can be a global. Call before compiling its value.
+static void declareVariable(Parser* parser, Token* name) {
+  if (parser->scopeDepth > 0) {
+    declareLocal(parser, name);
+  } else if (inputSlot(parser, name) != -1) {
+    error(parser, "Already an input with this name.");
+  }
+}
+
+// Gives the variable declared by declareVariable() the value on top of the
+// stack. In a block the value stays there, in the slot of the new local.
+static void defineVariable(Parser* parser, Token* name) {
+  if (parser->scopeDepth > 0) {
+    markInitialized(parser);
+    return;
+  }
+  int slot = globalSlot(parser, name);
+  parser->globals[slot].declared = true;
+  emitBytes(parser, OP_SET_GLOBAL, (uint8_t)slot);
+  emitByte(parser, OP_POP);
+}
+
+// let name [= value]. The variable holds nil without a value.
+static void letDeclaration(Parser* parser) {
+  consume(parser, TOKEN_IDENTIFIER, "Expect variable name.");
+  Token name = parser->previous;
+  declareVariable(parser, &name);
+
+  if (match(parser, TOKEN_EQUAL)) {
+    expression(parser);
+  } else {
+    emitByte(parser, OP_NIL);
+  }
+  defineVariable(parser, &name);
+}
+
+// class Name {}, declaring a variable holding the class. Classes have no
+// methods yet, so the body is empty; instances get their fields when they
+// are assigned.
+static void classDeclaration(Parser* parser) {
+  consume(parser, TOKEN_IDENTIFIER, "Expect class name.");
+  Token name = parser->previous;
+  declareVariable(parser, &name);
+
+  int constant =
+      makeConstant(parser, OBJ_VAL(copyString(name.start, name.length)));
+  if (constant > UINT16_MAX) {
+    error(parser, "Too many constants in one chunk.");
+  }
+  emitByte(parser, OP_CLASS);
+  emitBytes(parser, (uint8_t)(constant >> 8), (uint8_t)constant);
+  defineVariable(parser, &name);
+
+  consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before class body.");
+  while (atSeparator(parser)) advance(parser);
+  consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after class body.");
+}
+
+static void beginScope(Parser* parser) { parser->scopeDepth++; }
+
+// Pops the locals of the block being left, all at once.
+static void endScope(Parser* parser) {
+  parser->scopeDepth--;
+
+  int count = 0;
+  while (parser->localCount > 0 &&
+         parser->locals[parser->localCount - 1].depth > parser->scopeDepth) {
+    parser->localCount--;
+    count++;
+  }
+
+  if (count == 1) {
+    emitByte(parser, OP_POP);
+  } else if (count > 1) {
+    emitBytes(parser, OP_POPN, (uint8_t)count);
+  }
+}
+
+static void block(Parser* parser);
+
+// A local the program cannot name, for the hidden slots of a loop.
+static void addHiddenLocal(Parser* parser, const char* name) {
+  Token token;
+  token.type = TOKEN_IDENTIFIER;
+  token.start = name;
+  token.length = (int)strlen(name);
+  token.line = parser->previous.line;
+  declareLocal(parser, &token);
+  markInitialized(parser);
+}
+
+// for name in start..limit { body }. The bounds are evaluated once, into
+// hidden locals below the loop variable, and the loop runs for every whole
+// step from start up to and including limit.
+static void forStatement(Parser* parser) {
+  beginScope(parser);
+  consume(parser, TOKEN_IDENTIFIER, "Expect loop variable name.");
+  Token name = parser->previous;
+  consume(parser, TOKEN_IN, "Expect 'in' after loop variable.");
+
+  expression(parser);
+  addHiddenLocal(parser, "(counter)");
+  consume(parser, TOKEN_DOT_DOT, "Expect '..' in range.");
+  expression(parser);
+  addHiddenLocal(parser, "(limit)");
+
+  int exitJump = currentChunk(parser)->count;
+  emitByte(parser, OP_FOR_RANGE);
+  emitBytes(parser, 0xff, 0xff);
+  declareLocal(parser, &name);
+  markInitialized(parser);
+
+  int loopStart = currentChunk(parser)->count;
+  consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before loop body.");
+  beginScope(parser);
+  block(parser);
+  endScope(parser);
+
+  int loop = currentChunk(parser)->count;
+  emitByte(parser, OP_FOR_LOOP);
+  emitBytes(parser, 0xff, 0xff);
+  if (!setJumpTarget(currentChunk(parser), loop, loopStart)) {
+    error(parser, "Loop body too large.");
+  }
+  if (!setJumpTarget(currentChunk(parser), exitJump,
+                     currentChunk(parser)->count)) {
+    error(parser, "Loop body too large.");
+  }
+
+  // Pops the loop variable and the hidden locals.
+  endScope(parser);
+}
+
+// Returns whether the statement leaves a value on the stack, which only
+// expression statements do.
+static bool statement(Parser* parser) {
+  if (match(parser, TOKEN_LET)) {
+    letDeclaration(parser);
+    return false;
+  }
+  if (match(parser, TOKEN_CLASS)) {
+    classDeclaration(parser);
+    return false;
+  }
+  if (match(parser, TOKEN_LEFT_BRACE)) {
+    beginScope(parser);
+    block(parser);
+    endScope(parser);
+    return false;
+  }
+  if (match(parser, TOKEN_FOR)) {
+    forStatement(parser);
+    return false;
+  }
+
+  expression(parser);
+  return true;
+}
+
+// Statements end at a newline, a semicolon, the `}` closing their block or
+// the end of the source. After an error, skips to the next statement so
+// later errors still get reported.
+static void endStatement(Parser* parser) {
+  if (parser->panicMode) {
+    parser->panicMode = false;
+    while (!check(parser, TOKEN_EOF) && !atSeparator(parser) &&
+           !check(parser, TOKEN_RIGHT_BRACE)) {
+      advance(parser);
+    }
+  } else if (!atSeparator(parser) && !check(parser, TOKEN_RIGHT_BRACE) &&
+             !check(parser, TOKEN_EOF)) {
+    errorAtCurrent(parser, "Expect newline or ';' after statement.");
+  }
+
+  while (atSeparator(parser)) advance(parser);
+}
+
+// The statements of a block up to its `}`. A block has no value, so those
+// of its expression statements are popped.
+static void block(Parser* parser) {
+  while (atSeparator(parser)) advance(parser);
+  while (!check(parser, TOKEN_RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+    if (statement(parser)) emitByte(parser, OP_POP);
+    endStatement(parser);
+  }
+
+  consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after block.");
+}
+
+// Reports the globals that are used but never declared. The others are
+// checked when they are read, see OP_GET_GLOBAL.
+static void checkGlobals(Parser* parser) {
+  for (int i = 0; i < parser->globalCount; i++) {
+    if (parser->globals[i].declared) continue;
+    parser->panicMode = false;
+    errorAtToken(parser, &parser->globals[i].name, "Undefined variable.");
+  }
 }
 
 ParseRule rules[] = {
-    [TOKEN_LEFT_PAREN] = {grouping, NULL, PREC_NONE},  // (
+    [TOKEN_LEFT_PAREN] = {grouping, call, PREC_CALL},  // (
     [TOKEN_RIGHT_PAREN] = {NULL, NULL, PREC_NONE},     // )
     [TOKEN_LEFT_BRACKET] = {NULL, NULL, PREC_NONE},    // [
     [TOKEN_RIGHT_BRACKET] = {NULL, NULL, PREC_NONE},   // ]
@@ -228,7 +827,7 @@ ParseRule rules[] = {
     [TOKEN_COLON] = {NULL, NULL, PREC_NONE},           // :
     [TOKEN_SEMICOLON] = {NULL, NULL, PREC_NONE},       // ;
     [TOKEN_HASH] = {NULL, NULL, PREC_NONE},            // #
-    [TOKEN_DOT] = {NULL, NULL, PREC_NONE},             // .
+    [TOKEN_DOT] = {NULL, dot, PREC_CALL},              // .
     [TOKEN_DOT_DOT] = {NULL, NULL, PREC_NONE},         // ..
 
     [TOKEN_PLUS] = {NULL, binary, PREC_TERM},                // +
@@ -265,10 +864,10 @@ ParseRule rules[] = {
     [TOKEN_AMP_EQUAL] = {NULL, NULL, PREC_NONE},    // &=
     [TOKEN_CARET_EQUAL] = {NULL, NULL, PREC_NONE},  // ^=
 
-    [TOKEN_IDENTIFIER] = {NULL, NULL, PREC_NONE},     // identifier
-    [TOKEN_STRING] = {NULL, NULL, PREC_NONE},         // string
-    [TOKEN_INTERPOLATION] = {NULL, NULL, PREC_NONE},  // string interpolation
-    [TOKEN_NUMBER] = {number, NULL, PREC_NONE},       // number
+    [TOKEN_IDENTIFIER] = {variable, NULL, PREC_NONE},  // identifier
+    [TOKEN_STRING] = {string, NULL, PREC_NONE},        // string
+    [TOKEN_INTERPOLATION] = {NULL, NULL, PREC_NONE},   // string interpolation
+    [TOKEN_NUMBER] = {number, NULL, PREC_NONE},        // number
 
     // Keywords.
     [TOKEN_AND] = {NULL, NULL, PREC_NONE},       // and
@@ -300,26 +899,87 @@ ParseRule rules[] = {
 
 static ParseRule* getRule(TokenType type) { return &rules[type]; }
 
-bool compile(const char* source, Chunk* chunk) {
+// Compiles source into chunk with the given inputs and globals, either of
+// which may be missing.
+static bool compileChunk(const char* source, Chunk* chunk,
+                         const char* const* inputNames, int inputCount,
+                         const ValueArray* globals) {
   Parser parser;
   Scanner scanner;
   initScanner(&scanner, source);
-  compilingChunk = chunk;
 
   parser.scanner = &scanner;
+  parser.chunk = chunk;
+  initTable(&parser.constantIndex);
+  parser.inputNames = inputNames;
+  parser.inputCount = inputCount;
+  parser.globalCount = 0;
+  parser.localCount = 0;
+  parser.scopeDepth = 0;
   parser.hadError = false;
   parser.panicMode = false;
+  parser.canAssign = false;
+
+  if (globals != NULL) {
+    for (int i = 0; i < globals->count; i++) {
+      ObjString* name = AS_STRING(globals->values[i]);
+      Global* global = &parser.globals[parser.globalCount++];
+      global->name = (Token){TOKEN_IDENTIFIER, name->chars, name->length, 0};
+      global->declared = true;
+      writeValueArray(&chunk->globals,
+                      OBJ_VAL(copyString(name->chars, name->length)));
+    }
+  }
 
+  // The chunk returns the value of its last statement, or nil if that
+  // declares a variable. Every other value is popped.
   advance(&parser);
-  expression(&parser);
-  // consume(&parser, TOKEN_EOF, "Expect end of expression.");
+  while (atSeparator(&parser)) advance(&parser);
+  bool hasValue = false;
+  while (!check(&parser, TOKEN_EOF)) {
+    hasValue = statement(&parser);
+    int line = parser.previous.line;
+    endStatement(&parser);
+    if (hasValue && !check(&parser, TOKEN_EOF)) {
+      writeChunk(currentChunk(&parser), OP_POP, line);
+    }
+  }
+  if (!hasValue) emitByte(&parser, OP_NIL);
+  checkGlobals(&parser);
 
   endCompiler(&parser);
+  freeTable(&parser.constantIndex);
+
+  if (!parser.hadError) {
+    optimizeChunk(chunk);
+    // Sizes the VM stack for the chunk. Failing here is a compiler bug.
+    if (!verifyChunk(chunk, inputCount)) parser.hadError = true;
+  }
 
 #ifdef DEBUG_PRINT_CODE
   if (!parser.hadError) {
-    disassembleChunk(currentChunk(), "code");
+    disassembleChunk(chunk, "code");
   }
 #endif
   return !parser.hadError;
 }
+
+bool compile(const char* source, Chunk* chunk) {
+  return compileChunk(source, chunk, NULL, 0, NULL);
+}
+
+// Compiles source like compile(), except that each identifier listed in
+// inputNames reads the input at the same index. At most MAX_INPUTS names.
+bool compileWithInputs(const char* source, Chunk* chunk,
+                       const char* const* inputNames, int inputCount) {
+  return compileChunk(source, chunk, inputNames, inputCount, NULL);
+}
+
+// Compiles source like compile(), with the globals named in globals, the
+// globals of a chunk compiled earlier, declared already and in the same
+// slots. Lets each line of a REPL session see the variables of the earlier
+// ones.
+bool compileWithGlobals(const char* source, Chunk* chunk,
+                        const ValueArray* globals) {
+  return compileChunk(source, chunk, NULL, 0, globals);
+}
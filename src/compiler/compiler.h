@@ -5,15 +5,55 @@
 
 #include "chunk.h"
 #include "scanner.h"
+#include "table.h"
 
+// A global variable of the chunk being compiled. Its slot is its index in
+// Parser.globals.
+typedef struct {
+  Token name;     // Where it is first mentioned, for errors.
+  bool declared;  // By a let somewhere in the chunk.
+} Global;
+
+// A variable declared inside a block. It lives in the stack slot given by
+// its index in Parser.locals.
+typedef struct {
+  Token name;
+  int depth;  // Of the block declaring it, -1 until its initializer is done.
+} Local;
+
+// Everything one compilation touches lives here, so separate threads can
+// compile at the same time.
 typedef struct {
   Scanner* scanner;
+  Chunk* chunk;
+  // Maps each constant already in chunk's pool to its index.
+  Table constantIndex;
+  // Identifiers that compile to OP_GET_INPUT with their index.
+  const char* const* inputNames;
+  int inputCount;
+  // Every name that is not an input is a global, given the next free slot
+  // when it is first mentioned.
+  Global globals[MAX_GLOBALS];
+  int globalCount;
+  // The locals in scope, outermost first, and how many blocks deep the
+  // compiler is. Zero is the top level, where variables are globals.
+  Local locals[MAX_LOCALS];
+  int localCount;
+  int scopeDepth;
 
   bool panicMode;
   bool hadError;
 
   Token current;
   Token previous;
+
+  // Where the code and constants of the left operand of the infix operator
+  // being compiled begin. Lets binary() fold two literal operands.
+  int operandStart;
+  int operandConstants;
+  // Whether the expression being parsed binds loosely enough to be the
+  // target of `=`.
+  bool canAssign;
 } Parser;
 
 typedef enum {
@@ -43,5 +83,9 @@ typedef struct {
 } ParseRule;
 
 bool compile(const char* source, Chunk* chunk);
+bool compileWithInputs(const char* source, Chunk* chunk,
+                       const char* const* inputNames, int inputCount);
+bool compileWithGlobals(const char* source, Chunk* chunk,
+                        const ValueArray* globals);
 
 #endif
@@ -0,0 +1,431 @@
+// A template JIT for x86-64 System V. Each instruction of a chunk is
+// translated by a fixed machine code template. Stack slot d lives in xmm<d>
+// for the whole function, so values never touch memory between
+// instructions; xmm15 is scratch. Chunks deeper than that, or using an
+// instruction without a template, stay interpreted.
+//
+// The generated function is a JitFunction: rdi holds the inputs, rsi the
+// result pointer. The prologue loads the NaN-boxing constants into r8-r10.
+// Slots whose type is known at compile time, such as constants and results of
+// arithmetic, are not checked again. Only values read from inputs need checks.
+
+#include "jit.h"
+
+#ifdef BYTE_JIT
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "common.h"
+#include "memory.h"
+
+#define JIT_SLOTS 15
+#define SCRATCH 15
+
+enum { RAX = 0, RCX = 1, RDX = 2, RSI = 6, RDI = 7, R8 = 8, R9 = 9, R10 = 10 };
+
+typedef enum {
+  TYPE_UNKNOWN,
+  TYPE_NUMBER,
+  TYPE_BOOL,
+  TYPE_NIL,
+} StaticType;
+
+typedef struct {
+  uint8_t* code;
+  int count;
+  int capacity;
+
+  // Offsets of the rel32 fields of the jumps to the bail-out exit.
+  int* bailouts;
+  int bailoutCount;
+  int bailoutCapacity;
+} Assembler;
+
+static void emit(Assembler* as, uint8_t byte) {
+  if (as->capacity < as->count + 1) {
+    int oldCapacity = as->capacity;
+    as->capacity = GROW_CAPACITY(oldCapacity);
+    as->code = GROW_ARRAY(uint8_t, as->code, oldCapacity, as->capacity);
+  }
+  as->code[as->count++] = byte;
+}
+
+static void emit32(Assembler* as, uint32_t value) {
+  for (int i = 0; i < 4; i++) emit(as, (uint8_t)(value >> (i * 8)));
+}
+
+static void emit64(Assembler* as, uint64_t value) {
+  for (int i = 0; i < 8; i++) emit(as, (uint8_t)(value >> (i * 8)));
+}
+
+static void emitRex(Assembler* as, bool wide, int reg, int rm) {
+  uint8_t rex = 0x40 | (wide << 3) | ((reg >> 3) << 2) | (rm >> 3);
+  if (rex != 0x40) emit(as, rex);
+}
+
+static void emitModRM(Assembler* as, int mod, int reg, int rm) {
+  emit(as, (uint8_t)((mod << 6) | ((reg & 7) << 3) | (rm & 7)));
+}
+
+// An SSE instruction between two xmm registers, with its mandatory prefix.
+static void sse(Assembler* as, uint8_t prefix, uint8_t opcode, int dst,
+                int src) {
+  emit(as, prefix);
+  emitRex(as, false, dst, src);
+  emit(as, 0x0F);
+  emit(as, opcode);
+  emitModRM(as, 3, dst, src);
+}
+
+static void cmpsd(Assembler* as, int dst, int src, uint8_t predicate) {
+  sse(as, 0xF2, 0xC2, dst, src);
+  emit(as, predicate);
+}
+
+static void movqToGpr(Assembler* as, int gpr, int xmm) {
+  emit(as, 0x66);
+  emitRex(as, true, xmm, gpr);
+  emit(as, 0x0F);
+  emit(as, 0x7E);
+  emitModRM(as, 3, xmm, gpr);
+}
+
+static void movqToXmm(Assembler* as, int xmm, int gpr) {
+  emit(as, 0x66);
+  emitRex(as, true, xmm, gpr);
+  emit(as, 0x0F);
+  emit(as, 0x6E);
+  emitModRM(as, 3, xmm, gpr);
+}
+
+static void movImm64(Assembler* as, int gpr, uint64_t value) {
+  emitRex(as, true, 0, gpr);
+  emit(as, (uint8_t)(0xB8 + (gpr & 7)));
+  emit64(as, value);
+}
+
+// `opcode r/m64, r64` for the two-operand ALU instructions.
+static void alu64(Assembler* as, uint8_t opcode, int rm, int reg) {
+  emitRex(as, true, reg, rm);
+  emit(as, opcode);
+  emitModRM(as, 3, reg, rm);
+}
+
+#define ALU_OR 0x09
+#define ALU_AND 0x21
+#define ALU_XOR 0x31
+#define ALU_CMP 0x39
+
+// setcc into one of al, cl, dl.
+static void setcc(Assembler* as, uint8_t condition, int gpr) {
+  emit(as, 0x0F);
+  emit(as, condition);
+  emitModRM(as, 3, 0, gpr);
+}
+
+#define SETE 0x94
+#define SETNP 0x9B
+
+// Jumps to the bail-out exit when the flags say equal.
+static void jeBailout(Assembler* as) {
+  emit(as, 0x0F);
+  emit(as, 0x84);
+
+  if (as->bailoutCapacity < as->bailoutCount + 1) {
+    int oldCapacity = as->bailoutCapacity;
+    as->bailoutCapacity = GROW_CAPACITY(oldCapacity);
+    as->bailouts =
+        GROW_ARRAY(int, as->bailouts, oldCapacity, as->bailoutCapacity);
+  }
+  as->bailouts[as->bailoutCount++] = as->count;
+  emit32(as, 0);
+}
+
+static void loadValue(Assembler* as, int slot, Value value) {
+  movImm64(as, RAX, value);
+  movqToXmm(as, slot, RAX);
+}
+
+// Bails out unless slot holds a number: the QNAN bits are all set only in
+// boxed values that are not numbers.
+static void checkNumber(Assembler* as, int slot) {
+  movqToGpr(as, RAX, slot);
+  alu64(as, ALU_AND, RAX, R8);
+  alu64(as, ALU_CMP, RAX, R8);
+  jeBailout(as);
+}
+
+// Turns the 0/1 in cl into a boxed bool in slot.
+static void boolFromCl(Assembler* as, int slot) {
+  emit(as, 0x0F);  // movzx ecx, cl
+  emit(as, 0xB6);
+  emitModRM(as, 3, RCX, RCX);
+  alu64(as, ALU_OR, RCX, R9);  // FALSE_VAL | 1 is TRUE_VAL.
+  movqToXmm(as, slot, RCX);
+}
+
+static void andCl1(Assembler* as) {
+  emit(as, 0x80);  // and cl, 1
+  emitModRM(as, 3, 4, RCX);
+  emit(as, 1);
+}
+
+// a < b, b < a, !(a < b) or !(b < a) into slot a, matching the VM's use of
+// negated comparisons for >= and <=, so NaN behaves the same.
+static void compare(Assembler* as, int a, int b, bool swap, bool negate) {
+  uint8_t predicate = negate ? 5 : 1;  // NLT : LT
+  if (swap) {
+    sse(as, 0x66, 0x28, SCRATCH, b);  // movapd
+    cmpsd(as, SCRATCH, a, predicate);
+    sse(as, 0x66, 0x28, a, SCRATCH);
+  } else {
+    cmpsd(as, a, b, predicate);
+  }
+  movqToGpr(as, RCX, a);
+  andCl1(as);
+  boolFromCl(as, a);
+}
+
+// valuesEqual(): numbers compare as doubles, everything else by bits. A
+// boxed non-number is a NaN to ucomisd, so it never compares equal as a
+// double, and equal bits only count when they are not a number.
+static void equal(Assembler* as, int a, int b, bool negate) {
+  movqToGpr(as, RAX, a);
+  movqToGpr(as, RDX, b);
+  alu64(as, ALU_XOR, RCX, RCX);
+  alu64(as, ALU_CMP, RAX, RDX);
+  setcc(as, SETE, RCX);
+  alu64(as, ALU_AND, RAX, R8);
+  alu64(as, ALU_CMP, RAX, R8);
+  setcc(as, SETE, RDX);
+  emit(as, 0x20);  // and cl, dl
+  emitModRM(as, 3, RDX, RCX);
+
+  sse(as, 0x66, 0x2E, a, b);  // ucomisd
+  setcc(as, SETE, RAX);
+  setcc(as, SETNP, RDX);
+  emit(as, 0x20);  // and al, dl
+  emitModRM(as, 3, RDX, RAX);
+  emit(as, 0x08);  // or cl, al
+  emitModRM(as, 3, RAX, RCX);
+
+  if (negate) {
+    emit(as, 0x80);  // xor cl, 1
+    emitModRM(as, 3, 6, RCX);
+    emit(as, 1);
+  }
+  boolFromCl(as, a);
+}
+
+// isFalsy(): only nil and false.
+static void logicalNot(Assembler* as, int a) {
+  movqToGpr(as, RAX, a);
+  alu64(as, ALU_XOR, RCX, RCX);
+  alu64(as, ALU_CMP, RAX, R10);
+  setcc(as, SETE, RCX);
+  alu64(as, ALU_CMP, RAX, R9);
+  setcc(as, SETE, RDX);
+  emit(as, 0x08);  // or cl, dl
+  emitModRM(as, 3, RDX, RCX);
+  boolFromCl(as, a);
+}
+
+static StaticType typeOf(Value value) {
+  if (IS_NUMBER(value)) return TYPE_NUMBER;
+  if (IS_BOOL(value)) return TYPE_BOOL;
+  if (IS_NIL(value)) return TYPE_NIL;
+  return TYPE_UNKNOWN;
+}
+
+// Makes sure slot holds a number, checking at run time only if its type is
+// not known. Fails if it is known not to be one.
+static bool requireNumber(Assembler* as, StaticType* types, int slot) {
+  if (types[slot] == TYPE_UNKNOWN) {
+    checkNumber(as, slot);
+    types[slot] = TYPE_NUMBER;
+  }
+  return types[slot] == TYPE_NUMBER;
+}
+
+static bool translate(Assembler* as, Chunk* chunk) {
+  StaticType types[JIT_SLOTS + 1];
+  int depth = 0;
+
+  movImm64(as, R8, QNAN);
+  movImm64(as, R9, FALSE_VAL);
+  movImm64(as, R10, NIL_VAL);
+
+  for (int offset = 0; offset < chunk->count;) {
+    // The chunk may already have been quickened by the interpreter.
+    uint8_t instruction = unquickened(loadOpcode(&chunk->code[offset]));
+    uint8_t* operand = &chunk->code[offset + 1];
+    offset += 1 + opInfo[instruction].operandBytes;
+
+    // Slots of the top two values, for the binary instructions. Code that
+    // would pop more than was pushed is left to the interpreter.
+    int a = depth - 2;
+    int b = depth - 1;
+
+    switch (instruction) {
+      case OP_CONSTANT:
+      case OP_CONSTANT_LONG: {
+        int index = operand[0];
+        if (instruction == OP_CONSTANT_LONG) {
+          index = (operand[0] << 16) | (operand[1] << 8) | operand[2];
+        }
+        if (depth == JIT_SLOTS) return false;
+        Value value = chunk->constants.values[index];
+        loadValue(as, depth, value);
+        types[depth++] = typeOf(value);
+        break;
+      }
+      case OP_NIL:
+      case OP_TRUE:
+      case OP_FALSE: {
+        if (depth == JIT_SLOTS) return false;
+        Value value = instruction == OP_NIL    ? NIL_VAL
+                      : instruction == OP_TRUE ? TRUE_VAL
+                                               : FALSE_VAL;
+        loadValue(as, depth, value);
+        types[depth++] = typeOf(value);
+        break;
+      }
+      case OP_GET_INPUT:
+        if (depth == JIT_SLOTS) return false;
+        emit(as, 0xF2);  // movsd xmm, [rdi + 8 * slot]
+        emitRex(as, false, depth, RDI);
+        emit(as, 0x0F);
+        emit(as, 0x10);
+        emitModRM(as, 2, depth, RDI);
+        emit32(as, (uint32_t)operand[0] * sizeof(Value));
+        types[depth++] = TYPE_UNKNOWN;
+        break;
+
+      case OP_EQUAL:
+      case OP_NOT_EQUAL:
+        if (depth < 2) return false;
+        equal(as, a, b, instruction == OP_NOT_EQUAL);
+        types[a] = TYPE_BOOL;
+        depth--;
+        break;
+
+      case OP_ADD_CONST:
+      case OP_SUBTRACT_CONST:
+      case OP_MULTIPLY_CONST:
+      case OP_DIVIDE_CONST:
+        // The constant takes the next slot, then the plain template runs.
+        if (depth < 1 || depth == JIT_SLOTS) return false;
+        loadValue(as, depth, chunk->constants.values[operand[0]]);
+        types[depth] = TYPE_NUMBER;
+        a = depth - 1;
+        b = depth++;
+        instruction = instruction - OP_ADD_CONST + OP_ADD;
+        // Fall through.
+      case OP_ADD:
+      case OP_SUBTRACT:
+      case OP_MULTIPLY:
+      case OP_DIVIDE: {
+        if (depth < 2) return false;
+        if (!requireNumber(as, types, a) || !requireNumber(as, types, b)) {
+          return false;
+        }
+        static const uint8_t opcodes[] = {0x58, 0x5C, 0x59, 0x5E};
+        sse(as, 0xF2, opcodes[instruction - OP_ADD], a, b);
+        depth--;
+        break;
+      }
+
+      case OP_LESS:
+      case OP_GREATER:
+      case OP_GREATER_EQUAL:
+      case OP_LESS_EQUAL:
+        if (depth < 2) return false;
+        if (!requireNumber(as, types, a) || !requireNumber(as, types, b)) {
+          return false;
+        }
+        compare(as, a, b,
+                instruction == OP_GREATER || instruction == OP_LESS_EQUAL,
+                instruction == OP_GREATER_EQUAL ||
+                    instruction == OP_LESS_EQUAL);
+        types[a] = TYPE_BOOL;
+        depth--;
+        break;
+
+      case OP_NOT:
+        if (depth < 1) return false;
+        logicalNot(as, b);
+        types[b] = TYPE_BOOL;
+        break;
+      case OP_NEGATE:
+        if (depth < 1 || !requireNumber(as, types, b)) return false;
+        movImm64(as, RAX, SIGN_BIT);
+        movqToXmm(as, SCRATCH, RAX);
+        sse(as, 0x66, 0x57, b, SCRATCH);  // xorpd
+        break;
+
+      case OP_RETURN:
+        if (depth < 1) return false;
+        emit(as, 0xF2);  // movsd [rsi], xmm
+        emitRex(as, false, b, RSI);
+        emit(as, 0x0F);
+        emit(as, 0x11);
+        emitModRM(as, 0, b, RSI);
+        emit(as, 0xB8);  // mov eax, 1
+        emit32(as, 1);
+        emit(as, 0xC3);  // ret
+
+        // The bail-out exit.
+        for (int i = 0; i < as->bailoutCount; i++) {
+          int field = as->bailouts[i];
+          uint32_t distance = (uint32_t)(as->count - (field + 4));
+          memcpy(&as->code[field], &distance, sizeof(distance));
+        }
+        alu64(as, ALU_XOR, RAX, RAX);
+        emit(as, 0xC3);
+        return true;
+
+      default:
+        return false;
+    }
+  }
+
+  return false;
+}
+
+// Compiles chunk and installs the code in chunk->jitCode. Returns false and
+// leaves the chunk interpreted if some instruction has no template.
+bool jitCompile(Chunk* chunk) {
+  Assembler as = {NULL, 0, 0, NULL, 0, 0};
+  bool ok = translate(&as, chunk);
+
+  void* code = MAP_FAILED;
+  if (ok) {
+    // Written while writable, then flipped to executable: never both.
+    code = mmap(NULL, as.count, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ok = code != MAP_FAILED;
+  }
+  if (ok) {
+    memcpy(code, as.code, as.count);
+    ok = mprotect(code, as.count, PROT_READ | PROT_EXEC) == 0;
+    if (!ok) munmap(code, as.count);
+  }
+  if (ok) {
+    chunk->jitSize = as.count;
+    __atomic_store_n(&chunk->jitCode, code, __ATOMIC_RELEASE);
+  }
+
+  FREE_ARRAY(uint8_t, as.code, as.capacity);
+  FREE_ARRAY(int, as.bailouts, as.bailoutCapacity);
+  return ok;
+}
+
+void jitFree(Chunk* chunk) {
+  if (chunk->jitCode != NULL) munmap(chunk->jitCode, chunk->jitSize);
+  chunk->jitCode = NULL;
+  chunk->jitSize = 0;
+}
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef BYTE_JIT_H
+#define BYTE_JIT_H
+
+#include "chunk.h"
+
+// Executions after which executeChunk() compiles a chunk to native code.
+#define JIT_THRESHOLD 1000
+
+// Native code for a chunk. Returns false without touching result when a type
+// check fails; the caller then runs the chunk in the interpreter instead,
+// which raises the error. That is only correct because chunks the JIT accepts
+// have no side effects.
+typedef bool (*JitFunction)(const Value* inputs, Value* result);
+
+bool jitCompile(Chunk* chunk);
+void jitFree(Chunk* chunk);
+
+#endif
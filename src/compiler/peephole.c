@@ -0,0 +1,117 @@
+#include "peephole.h"
+
+#include <string.h>
+
+#include "chunk.h"
+#include "common.h"
+#include "memory.h"
+
+static int instructionLength(Chunk* chunk, int offset) {
+  return 1 + opInfo[chunk->code[offset]].operandBytes;
+}
+
+// Returns the superinstruction replacing `first` followed by `second`, or -1
+// when the pair has none. Only the first of the two may carry operands.
+static int fuse(Chunk* chunk, int offset, int next) {
+  uint8_t first = chunk->code[offset];
+  uint8_t second = chunk->code[next];
+
+  switch (first) {
+    case OP_EQUAL:
+      return second == OP_NOT ? OP_NOT_EQUAL : -1;
+    case OP_LESS:
+      return second == OP_NOT ? OP_GREATER_EQUAL : -1;
+    case OP_GREATER:
+      return second == OP_NOT ? OP_LESS_EQUAL : -1;
+    case OP_CONSTANT: {
+      // The fused handlers only check the type of the other operand.
+      Value constant = chunk->constants.values[chunk->code[offset + 1]];
+      if (!IS_NUMBER(constant)) return -1;
+
+      switch (second) {
+        case OP_ADD:
+          return OP_ADD_CONST;
+        case OP_SUBTRACT:
+          return OP_SUBTRACT_CONST;
+        case OP_MULTIPLY:
+          return OP_MULTIPLY_CONST;
+        case OP_DIVIDE:
+          return OP_DIVIDE_CONST;
+        default:
+          return -1;
+      }
+    }
+    default:
+      return -1;
+  }
+}
+
+// Rewrites common instruction pairs emitted by the compiler into single
+// superinstructions, so evaluating them costs one dispatch instead of two.
+// The fused instruction keeps the operands of the first instruction of the
+// pair and the line of whichever of the two could raise a runtime error.
+// Fusing moves the code after it, so jumps are pointed at where their
+// targets end up, and a pair is left alone if a jump lands between the two.
+void optimizeChunk(Chunk* chunk) {
+  Chunk optimized;
+  initChunk(&optimized);
+
+  // The new offset of each old instruction.
+  int* moved = ALLOCATE(int, chunk->count + 1);
+  bool* targets = ALLOCATE(bool, chunk->count + 1);
+  memset(targets, 0, sizeof(bool) * (size_t)(chunk->count + 1));
+  for (int offset = 0; offset < chunk->count;) {
+    if (isJump(chunk->code[offset])) targets[jumpTarget(chunk, offset)] = true;
+    offset += instructionLength(chunk, offset);
+  }
+
+  for (int offset = 0; offset < chunk->count;) {
+    int length = instructionLength(chunk, offset);
+    int next = offset + length;
+    moved[offset] = optimized.count;
+
+    int fused = next < chunk->count && !targets[next]
+                    ? fuse(chunk, offset, next)
+                    : -1;
+    if (fused != -1) {
+      int line =
+          getLine(chunk, chunk->code[offset] == OP_CONSTANT ? next : offset);
+      writeChunk(&optimized, (uint8_t)fused, line);
+      for (int i = 1; i < length; i++) {
+        writeChunk(&optimized, chunk->code[offset + i], line);
+      }
+      offset = next + instructionLength(chunk, next);
+      continue;
+    }
+
+    int line = getLine(chunk, offset);
+    for (int i = 0; i < length; i++) {
+      writeChunk(&optimized, chunk->code[offset + i], line);
+    }
+    offset = next;
+  }
+  moved[chunk->count] = optimized.count;
+
+  // Jumps are never fused, and code only gets shorter, so every jump still
+  // reaches.
+  for (int offset = 0; offset < chunk->count;) {
+    if (isJump(chunk->code[offset])) {
+      setJumpTarget(&optimized, moved[offset],
+                    moved[jumpTarget(chunk, offset)]);
+    }
+    offset += instructionLength(chunk, offset);
+  }
+  FREE_ARRAY(int, moved, chunk->count + 1);
+  FREE_ARRAY(bool, targets, chunk->count + 1);
+
+  // The constant pool and the names are unchanged; move them over instead
+  // of copying.
+  optimized.constants = chunk->constants;
+  optimized.globals = chunk->globals;
+  optimized.properties = chunk->properties;
+  initValueArray(&chunk->constants);
+  initValueArray(&chunk->globals);
+  initValueArray(&chunk->properties);
+  freeChunk(chunk);
+  *chunk = optimized;
+}
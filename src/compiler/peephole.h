@@ -0,0 +1,8 @@
+#ifndef BYTE_PEEPHOLE_H
+#define BYTE_PEEPHOLE_H
+
+#include "chunk.h"
+
+void optimizeChunk(Chunk* chunk);
+
+#endif
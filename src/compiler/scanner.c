@@ -3,6 +3,8 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "scanner_simd.h"
+
 void initScanner(Scanner* s, const char* source) {
   s->current = source;
   s->start = source;
@@ -101,16 +103,20 @@ static void skipWhitespace(Scanner* s) {
     char c = current(s);
 
     switch (c) {
+      // Neither skip crosses a newline, so the line count is unaffected.
+      // Single separators are the common case and not worth a vector search.
       case ' ':
       case '\r':
       case '\t':
         advance(s);
+        c = current(s);
+        if (c == ' ' || c == '\r' || c == '\t')
+          s->current = skipBlanks(s->current);
         break;
 
       // skip line comment
       case '#': {
-        while (current(s) != '\n' && !isAtEnd(s))
-          advance(s);
+        s->current = findLineEnd(s->current);
         break;
       }
 
@@ -121,7 +127,12 @@ static void skipWhitespace(Scanner* s) {
 }
 
 static Token string(Scanner* s, char quote) {
-  while (current(s) != quote && !isAtEnd(s)) {
+  while (true) {
+    // Jump over plain characters; newlines are still consumed by advance().
+    s->current = findStringSpecial(s->current, quote);
+    if (current(s) == quote || isAtEnd(s))
+      break;
+
     if (current(s) == '$' && next(s) == '{' && previous(s) != '\\') {
       if (s->interpolatingCount - 1 < MAX_INTERPOLATION_NESTING) {
         s->interpolatingCount++;
@@ -179,22 +190,98 @@ Token number(Scanner* s) {
   return makeToken(s, TOKEN_NUMBER);
 }
 
-static Token identifier(Scanner* s) {
-  while (isAlpha(current(s)) || isDigit(current(s)))
-    advance(s);
-
-  TokenType type = TOKEN_IDENTIFIER;
-  size_t length = s->current - s->start;
+// Matches the rest of a keyword once its length and leading characters have
+// picked it as the only candidate, so every identifier costs at most one
+// comparison.
+static TokenType checkKeyword(Scanner* s,
+                              int start,
+                              const char* rest,
+                              TokenType type) {
+  if (memcmp(s->start + start, rest, strlen(rest)) == 0)
+    return type;
+  return TOKEN_IDENTIFIER;
+}
 
-  for (int i = 0; keywords[i].identifier != NULL; i++) {
-    if (length == keywords[i].length &&
-        memcmp(s->start, keywords[i].identifier, length) == 0) {
-      type = keywords[i].tokenType;
+// A trie over the reserved words: and, class, else, false, for, func, if,
+// import, in, is, let, nil, not, or, print, return, super, this, true, while.
+static TokenType identifierType(Scanner* s, size_t length) {
+  const char* c = s->start;
+
+  switch (length) {
+    case 2:
+      switch (c[0]) {
+        case 'i':
+          switch (c[1]) {
+            case 'f':
+              return TOKEN_IF;
+            case 'n':
+              return TOKEN_IN;
+            case 's':
+              return TOKEN_IS;
+          }
+          break;
+        case 'o':
+          return checkKeyword(s, 1, "r", TOKEN_OR);
+      }
+      break;
+    case 3:
+      switch (c[0]) {
+        case 'a':
+          return checkKeyword(s, 1, "nd", TOKEN_AND);
+        case 'f':
+          return checkKeyword(s, 1, "or", TOKEN_FOR);
+        case 'l':
+          return checkKeyword(s, 1, "et", TOKEN_LET);
+        case 'n':
+          if (c[1] == 'i')
+            return checkKeyword(s, 2, "l", TOKEN_NIL);
+          return checkKeyword(s, 1, "ot", TOKEN_NOT);
+      }
+      break;
+    case 4:
+      switch (c[0]) {
+        case 'e':
+          return checkKeyword(s, 1, "lse", TOKEN_ELSE);
+        case 'f':
+          return checkKeyword(s, 1, "unc", TOKEN_FUNC);
+        case 't':
+          if (c[1] == 'h')
+            return checkKeyword(s, 2, "is", TOKEN_THIS);
+          return checkKeyword(s, 1, "rue", TOKEN_TRUE);
+      }
+      break;
+    case 5:
+      switch (c[0]) {
+        case 'c':
+          return checkKeyword(s, 1, "lass", TOKEN_CLASS);
+        case 'f':
+          return checkKeyword(s, 1, "alse", TOKEN_FALSE);
+        case 'p':
+          return checkKeyword(s, 1, "rint", TOKEN_PRINT);
+        case 's':
+          return checkKeyword(s, 1, "uper", TOKEN_SUPER);
+        case 'w':
+          return checkKeyword(s, 1, "hile", TOKEN_WHILE);
+      }
+      break;
+    case 6:
+      switch (c[0]) {
+        case 'i':
+          return checkKeyword(s, 1, "mport", TOKEN_IMPORT);
+        case 'r':
+          return checkKeyword(s, 1, "eturn", TOKEN_RETURN);
+      }
       break;
-    }
   }
 
-  return makeToken(s, type);
+  return TOKEN_IDENTIFIER;
+}
+
+static Token identifier(Scanner* s) {
+  while (isAlpha(current(s)) || isDigit(current(s)))
+    advance(s);
+
+  return makeToken(s, identifierType(s, s->current - s->start));
 }
 
 Token scanToken(Scanner* s) {
@@ -234,6 +321,8 @@ Token scanToken(Scanner* s) {
       return makeToken(s, TOKEN_COMMA);
     case ':':
       return makeToken(s, TOKEN_COLON);
+    case ';':
+      return makeToken(s, TOKEN_SEMICOLON);
     case '.':
       return makeToken(s, match(s, '.') ? TOKEN_DOT_DOT : TOKEN_DOT);
     case '+':
@@ -96,27 +96,6 @@ typedef enum {
   TOKEN_ERROR,
 } TokenType;
 
-typedef struct {
-  const char* identifier;
-  size_t length;
-  TokenType tokenType;
-} Keyword;
-
-// The table of reserved words and their associated token types.
-static Keyword keywords[] = {
-    {"and", 3, TOKEN_AND},       {"or", 2, TOKEN_OR},
-    {"not", 3, TOKEN_NOT},       {"nil", 3, TOKEN_NIL},
-    {"in", 2, TOKEN_IN},         {"is", 2, TOKEN_IS},
-    {"import", 6, TOKEN_IMPORT}, {"class", 5, TOKEN_CLASS},
-    {"if", 2, TOKEN_IF},         {"else", 4, TOKEN_ELSE},
-    {"true", 4, TOKEN_TRUE},     {"false", 5, TOKEN_FALSE},
-    {"func", 2, TOKEN_FUNC},     {"for", 3, TOKEN_FOR},
-    {"print", 5, TOKEN_PRINT},   {"return", 6, TOKEN_RETURN},
-    {"super", 5, TOKEN_SUPER},   {"this", 4, TOKEN_THIS},
-    {"let", 3, TOKEN_LET},       {"while", 5, TOKEN_WHILE},
-    {NULL, 0, TOKEN_EOF}  // Sentinel to mark the end of the array.
-};
-
 typedef struct {
   TokenType type;
   const char* start;
@@ -0,0 +1,200 @@
+#include "scanner_simd.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+static const char* skipBlanksScalar(const char* p) {
+  while (*p == ' ' || *p == '\t' || *p == '\r')
+    p++;
+  return p;
+}
+
+static const char* findLineEndScalar(const char* p) {
+  while (*p != '\n' && *p != '\0')
+    p++;
+  return p;
+}
+
+static const char* findStringSpecialScalar(const char* p, char quote) {
+  while (*p != quote && *p != '\\' && *p != '$' && *p != '\n' && *p != '\0')
+    p++;
+  return p;
+}
+
+static const char* (*skipBlanksImpl)(const char*) = skipBlanksScalar;
+static const char* (*findLineEndImpl)(const char*) = findLineEndScalar;
+static const char* (*findStringSpecialImpl)(const char*,
+                                            char) = findStringSpecialScalar;
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+
+// The vector versions only ever load whole aligned blocks. An aligned load
+// cannot cross into the next page, so reading the rest of the block holding
+// the '\0' terminator is safe even though it is past the end of the source.
+// Bits for the bytes before `p` in the first block are masked off.
+//
+// AddressSanitizer would still report those bytes as out of bounds, so the
+// functions doing the loads are not instrumented.
+
+__attribute__((target("sse2"))) static inline unsigned blankMask16(
+    __m128i block) {
+  __m128i blank = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')),
+                   _mm_cmpeq_epi8(block, _mm_set1_epi8('\t'))),
+      _mm_cmpeq_epi8(block, _mm_set1_epi8('\r')));
+  return (unsigned)_mm_movemask_epi8(blank);
+}
+
+__attribute__((target("sse2"))) static inline unsigned lineEndMask16(
+    __m128i block) {
+  return (unsigned)_mm_movemask_epi8(
+      _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('\n')),
+                   _mm_cmpeq_epi8(block, _mm_setzero_si128())));
+}
+
+__attribute__((target("sse2"))) static inline unsigned stringSpecialMask16(
+    __m128i block, __m128i quote) {
+  __m128i special = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(block, quote),
+                   _mm_cmpeq_epi8(block, _mm_set1_epi8('\\'))),
+      _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('$')),
+                   _mm_cmpeq_epi8(block, _mm_set1_epi8('\n'))));
+  special = _mm_or_si128(special, _mm_cmpeq_epi8(block, _mm_setzero_si128()));
+  return (unsigned)_mm_movemask_epi8(special);
+}
+
+__attribute__((target("sse2"), no_sanitize_address)) static const char*
+skipBlanksSse2(const char* p) {
+  uintptr_t misalign = (uintptr_t)p & 15;
+  const __m128i* block = (const __m128i*)(p - misalign);
+  unsigned mask = ~blankMask16(_mm_load_si128(block)) & (0xffffu << misalign);
+  while ((mask & 0xffff) == 0) {
+    block++;
+    mask = ~blankMask16(_mm_load_si128(block));
+  }
+  return (const char*)block + __builtin_ctz(mask);
+}
+
+__attribute__((target("sse2"), no_sanitize_address)) static const char*
+findLineEndSse2(const char* p) {
+  uintptr_t misalign = (uintptr_t)p & 15;
+  const __m128i* block = (const __m128i*)(p - misalign);
+  unsigned mask = lineEndMask16(_mm_load_si128(block)) & (0xffffu << misalign);
+  while (mask == 0) {
+    block++;
+    mask = lineEndMask16(_mm_load_si128(block));
+  }
+  return (const char*)block + __builtin_ctz(mask);
+}
+
+__attribute__((target("sse2"), no_sanitize_address)) static const char*
+findStringSpecialSse2(const char* p, char quote) {
+  __m128i quotes = _mm_set1_epi8(quote);
+  uintptr_t misalign = (uintptr_t)p & 15;
+  const __m128i* block = (const __m128i*)(p - misalign);
+  unsigned mask = stringSpecialMask16(_mm_load_si128(block), quotes) &
+                  (0xffffu << misalign);
+  while (mask == 0) {
+    block++;
+    mask = stringSpecialMask16(_mm_load_si128(block), quotes);
+  }
+  return (const char*)block + __builtin_ctz(mask);
+}
+
+__attribute__((target("avx2"))) static inline uint32_t blankMask32(
+    __m256i block) {
+  __m256i blank = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(' ')),
+                      _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\t'))),
+      _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\r')));
+  return (uint32_t)_mm256_movemask_epi8(blank);
+}
+
+__attribute__((target("avx2"))) static inline uint32_t lineEndMask32(
+    __m256i block) {
+  return (uint32_t)_mm256_movemask_epi8(
+      _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8('\n')),
+                      _mm256_cmpeq_epi8(block, _mm256_setzero_si256())));
+}
+
+__attribute__((target("avx2"))) static inline uint32_t stringSpecialMask32(
+    __m256i block, __m256i quote) {
+  __m256i special = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(block, quote),
+                      _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\\'))),
+      _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8('$')),
+                      _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\n'))));
+  special = _mm256_or_si256(
+      special, _mm256_cmpeq_epi8(block, _mm256_setzero_si256()));
+  return (uint32_t)_mm256_movemask_epi8(special);
+}
+
+__attribute__((target("avx2"), no_sanitize_address)) static const char*
+skipBlanksAvx2(const char* p) {
+  uintptr_t misalign = (uintptr_t)p & 31;
+  const __m256i* block = (const __m256i*)(p - misalign);
+  uint32_t mask = ~blankMask32(_mm256_load_si256(block)) &
+                  (UINT32_MAX << misalign);
+  while (mask == 0) {
+    block++;
+    mask = ~blankMask32(_mm256_load_si256(block));
+  }
+  return (const char*)block + __builtin_ctz(mask);
+}
+
+__attribute__((target("avx2"), no_sanitize_address)) static const char*
+findLineEndAvx2(const char* p) {
+  uintptr_t misalign = (uintptr_t)p & 31;
+  const __m256i* block = (const __m256i*)(p - misalign);
+  uint32_t mask =
+      lineEndMask32(_mm256_load_si256(block)) & (UINT32_MAX << misalign);
+  while (mask == 0) {
+    block++;
+    mask = lineEndMask32(_mm256_load_si256(block));
+  }
+  return (const char*)block + __builtin_ctz(mask);
+}
+
+__attribute__((target("avx2"), no_sanitize_address)) static const char*
+findStringSpecialAvx2(const char* p, char quote) {
+  __m256i quotes = _mm256_set1_epi8(quote);
+  uintptr_t misalign = (uintptr_t)p & 31;
+  const __m256i* block = (const __m256i*)(p - misalign);
+  uint32_t mask = stringSpecialMask32(_mm256_load_si256(block), quotes) &
+                  (UINT32_MAX << misalign);
+  while (mask == 0) {
+    block++;
+    mask = stringSpecialMask32(_mm256_load_si256(block), quotes);
+  }
+  return (const char*)block + __builtin_ctz(mask);
+}
+
+__attribute__((constructor)) static void selectImplementation() {
+  const char* forced = getenv("BYTE_SCANNER_SIMD");
+  bool allowAvx2 = forced == NULL || strcmp(forced, "avx2") == 0;
+  bool allowSse2 = allowAvx2 || strcmp(forced, "sse2") == 0;
+
+  __builtin_cpu_init();
+  if (allowAvx2 && __builtin_cpu_supports("avx2")) {
+    skipBlanksImpl = skipBlanksAvx2;
+    findLineEndImpl = findLineEndAvx2;
+    findStringSpecialImpl = findStringSpecialAvx2;
+  } else if (allowSse2 && __builtin_cpu_supports("sse2")) {
+    skipBlanksImpl = skipBlanksSse2;
+    findLineEndImpl = findLineEndSse2;
+    findStringSpecialImpl = findStringSpecialSse2;
+  }
+}
+#endif
+
+const char* skipBlanks(const char* p) { return skipBlanksImpl(p); }
+
+const char* findLineEnd(const char* p) { return findLineEndImpl(p); }
+
+const char* findStringSpecial(const char* p, char quote) {
+  return findStringSpecialImpl(p, quote);
+}
@@ -0,0 +1,22 @@
+#ifndef BYTE_SCANNER_SIMD_H
+#define BYTE_SCANNER_SIMD_H
+
+// Bulk character searches for the scanner. Each one returns a pointer to the
+// first byte at or after `p` that the scanner has to look at individually, so
+// it never skips past a '\n' or the terminating '\0' and line counting stays
+// with the scanner.
+//
+// The implementation is picked once at startup: AVX2 or SSE2 when the CPU has
+// them, plain loops otherwise. Setting BYTE_SCANNER_SIMD to "scalar", "sse2"
+// or "avx2" in the environment forces a narrower one for testing.
+
+// First byte that is not ' ', '\t' or '\r'.
+const char* skipBlanks(const char* p);
+
+// First '\n' or '\0'.
+const char* findLineEnd(const char* p);
+
+// First quote, '\\', '$', '\n' or '\0'.
+const char* findStringSpecial(const char* p, char quote);
+
+#endif
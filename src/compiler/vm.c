@@ -3,18 +3,27 @@
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "chunk.h"
 #include "common.h"
 #include "compiler.h"
+#include "counters.h"
 #include "debug.h"
+#include "jit.h"
+#include "memory.h"
+#include "object.h"
+#include "profiler.h"
+#include "scanner.h"
 #include "value.h"
 
-VM vm;
+// Range bounds must be smaller than this in magnitude. Up to it every count
+// is exact, so OP_FOR_LOOP always gets past the limit.
+#define MAX_RANGE_BOUND 9007199254740992.0  // 2^53
 
-static void resetStack() { vm.stackTop = vm.stack; }
+static void resetStack(VM* vm) { vm->stackTop = vm->stack; }
 
-static void runtimeError(const char* format, ...) {
+static void runtimeError(VM* vm, const char* format, ...) {
   // c way for variadic function
   // print error message in stderr
   va_list args;
@@ -24,137 +33,380 @@ static void runtimeError(const char* format, ...) {
   fputs("\n", stderr);
 
   // find line no and then print it out
-  size_t instruction = vm.ip - vm.chunk->code - 1;
-  int line = vm.chunk->lines[instruction];
+  size_t instruction = vm->ip - vm->chunk->code - 1;
+  int line = getLine(vm->chunk, (int)instruction);
   fprintf(stderr, "[line %d] in script\n", line);
-  resetStack();
+  resetStack(vm);
 }
 
-void initVM() { resetStack(); }
+VM* newVM() {
+  VM* vm = ALLOCATE(VM, 1);
+  vm->chunk = NULL;
+  vm->ip = NULL;
+  vm->stack = NULL;
+  vm->stackCapacity = 0;
+  vm->globals = NULL;
+  vm->globalCount = 0;
+  vm->globalCapacity = 0;
+  vm->lines = NULL;
+  vm->lineCount = 0;
+  vm->lineCapacity = 0;
+  vm->caches = NULL;
+  vm->cacheCapacity = 0;
+  vm->shapes = newShapeTree();
+  vm->inputs = NULL;
+  vm->profile = NULL;
+  vm->counters = NULL;
+  initHeap(&vm->heap);
+  resetStack(vm);
+  return vm;
+}
+
+void freeVM(VM* vm) {
+  freeHeap(&vm->heap);
+  FREE_ARRAY(Value, vm->stack, vm->stackCapacity);
+  FREE_ARRAY(Value, vm->globals, vm->globalCapacity);
+  FREE_ARRAY(PropertyCache, vm->caches, vm->cacheCapacity);
+  for (int i = 0; i < vm->lineCount; i++) {
+    freeChunk(vm->lines[i]);
+    FREE(Chunk, vm->lines[i]);
+  }
+  FREE_ARRAY(Chunk*, vm->lines, vm->lineCapacity);
+  freeShapeTree(vm->shapes);
+  FREE(VM, vm);
+}
+
+// Switches interpretChunk() to the instrumented copy of the run loop, which
+// records into profile. Pass NULL to switch back.
+void setProfile(VM* vm, Profile* profile) { vm->profile = profile; }
+
+// Counts hardware events around each phase in counters. If counters asks for
+// them by opcode class, also switches to the instrumented run loop. Pass NULL
+// to stop.
+void setCounters(VM* vm, Counters* counters) { vm->counters = counters; }
+
+// Switches major collections of vm's heap between stopping the VM and
+// marking on a background thread. See Heap.
+void setConcurrentGC(VM* vm, bool concurrent) {
+#ifdef BYTE_NAN_BOXING
+  vm->heap.concurrent = concurrent;
+#else
+  // See loadSlot().
+  (void)vm;
+  (void)concurrent;
+#endif
+}
 
-void freeVM() {}
+// Whether run() has to hear about every instruction.
+static bool instrumented(VM* vm) {
+  return vm->profile != NULL ||
+         (vm->counters != NULL && vm->counters->byOpcode);
+}
 
-void push(Value value) {
-  *vm.stackTop = value;
-  vm.stackTop++;
+// Called by the instrumented run loop before each instruction.
+static void instrumentInstruction(VM* vm) {
+  int offset = (int)(vm->ip - vm->chunk->code);
+  if (vm->profile != NULL) profileInstruction(vm->profile, vm->chunk, offset);
+  if (vm->counters != NULL && vm->counters->byOpcode) {
+    countInstruction(vm->counters, loadOpcode(&vm->chunk->code[offset]));
+  }
 }
 
-Value pop() {
-  vm.stackTop--;
-  return *vm.stackTop;
+void push(VM* vm, Value value) {
+  *vm->stackTop = value;
+  vm->stackTop++;
 }
 
-Value peek(int distance) { return vm.stackTop[-1 - distance]; }
+Value pop(VM* vm) {
+  vm->stackTop--;
+  return *vm->stackTop;
+}
 
-// nil and false are falsey and every other value behaves like true
-static bool isFalsy(Value value) {
-  return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+static Value peek(VM* vm, int distance) { return vm->stackTop[-1 - distance]; }
+
+// Whether bound is usable as a range bound. NaN is, and runs the loop no
+// times.
+static bool inRange(double bound) {
+  return !(bound >= MAX_RANGE_BOUND || bound <= -MAX_RANGE_BOUND);
 }
 
-static InterpretResult run() {
-#define READ_BYTE() (*vm.ip++)
-#define READ_CONSTANT() (vm.chunk->constants.values[READ_BYTE()])
-#define BINARY_OP(valueType, op)                      \
-  do {                                                \
-    if (!IS_NUMBER(peek(0)) && !IS_NUMBER(peek(1))) { \
-      runtimeError("Operators must be number.");      \
-      return INTERPRET_RUNTIME_ERROR;                 \
-    }                                                 \
-    double b = AS_NUMBER(pop());                      \
-    double a = AS_NUMBER(pop());                      \
-    push(valueType(a op b));                          \
-  } while (false)
+static void concatenate(VM* vm) {
+  int length = AS_STRING(peek(vm, 0))->length + AS_STRING(peek(vm, 1))->length;
+  ObjString* result = allocateString(vm, length);
+
+  // The operands may have moved while allocating.
+  ObjString* b = AS_STRING(peek(vm, 0));
+  ObjString* a = AS_STRING(peek(vm, 1));
+  memcpy(result->chars, a->chars, a->length);
+  memcpy(result->chars + a->length, b->chars, b->length);
+  result = finishString(vm, result);
 
-  for (;;) {
-#ifdef DEBUG_TRACE_EXECUTION
-    printf("          ");
-    for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
-      printf("[ ");
-      printValue(*slot);
-      printf(" ]");
+  vm->stackTop -= 2;
+  push(vm, OBJ_VAL(result));
+}
+
+// The entry cache has for instances of shape, or NULL.
+static CacheEntry* findEntry(PropertyCache* cache, Shape* shape) {
+  for (int i = 0; i < CACHE_WAYS; i++) {
+    if (cache->entries[i].shape == shape) return &cache->entries[i];
+  }
+  return NULL;
+}
+
+// Keeps entry in the first unused way of cache, if there is one left.
+static void addEntry(PropertyCache* cache, CacheEntry entry) {
+  for (int i = 0; i < CACHE_WAYS; i++) {
+    if (cache->entries[i].shape == NULL) {
+      cache->entries[i] = entry;
+      return;
     }
-    printf("\n");
-    disassembleInstruction(vm.chunk, (int)(vm.ip - vm.chunk->code));
-#endif
+  }
+}
 
-    uint8_t instruction;
-    switch (instruction = READ_BYTE()) {
-      case OP_CONSTANT: {
-        Value constant = READ_CONSTANT();
-        push(constant);
-        break;
-      }
-      case OP_NIL:
-        push(NIL_VAL);
-        break;
-      case OP_TRUE:
-        push(BOOL_VAL(true));
-        break;
-      case OP_FALSE:
-        push(BOOL_VAL(false));
-        break;
-      case OP_EQUAL: {
-        Value a = pop();
-        Value b = pop();
-        push(BOOL_VAL(valuesEqual(a, b)));
-        break;
-      }
-      case OP_GREATER:
-        BINARY_OP(BOOL_VAL, >);
-        break;
-      case OP_LESS:
-        BINARY_OP(BOOL_VAL, <);
-        break;
-      case OP_ADD:
-        BINARY_OP(NUMBER_VAL, +);
-        break;
-      case OP_SUBTRACT:
-        BINARY_OP(NUMBER_VAL, -);
-        break;
-      case OP_MULTIPLY:
-        BINARY_OP(NUMBER_VAL, *);
-        break;
-      case OP_DIVIDE:
-        BINARY_OP(NUMBER_VAL, /);
-        break;
-      case OP_NOT:
-        push(BOOL_VAL(isFalsy(pop())));
-        break;
-      case OP_NEGATE: {
-        if (!IS_NUMBER(peek(0))) {
-          runtimeError("Operand must be a number.");
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        push(NUMBER_VAL(-AS_NUMBER(pop())));
-        break;
-      }
-      case OP_RETURN: {
-        printValue(pop());
-        printf("\n");
-        return INTERPRET_OK;
-      }
+static void storeField(VM* vm, ObjFields* fields, int slot, Value value) {
+  writeBarrier(&vm->heap, &fields->obj, &fields->values[slot], value);
+  storeSlot(&fields->values[slot], value);
+}
+
+// Gives the instance below the top of the stack a field array of capacity
+// slots, holding what its old one did.
+static void growFields(VM* vm, int capacity) {
+  ObjFields* fields = newFields(vm, capacity);
+
+  // Allocating may have moved the instance and its old array.
+  ObjInstance* instance = AS_INSTANCE(peek(vm, 1));
+  Value old = NIL_VAL;
+  if (instance->fields != NULL) {
+    memcpy(fields->values, instance->fields->values,
+           sizeof(Value) * (size_t)instance->fields->capacity);
+    old = OBJ_VAL(instance->fields);
+  }
+  // Too large for the nursery, the array starts out old, and the fields
+  // copied into it may be young.
+  if (fields->obj.generation == GEN_OLD && !fields->obj.isRemembered) {
+    rememberObject(&vm->heap, &fields->obj);
+  }
+  writeBarrier(&vm->heap, &instance->obj, &old, OBJ_VAL(fields));
+  __atomic_store_n(&instance->fields, fields, __ATOMIC_RELEASE);
+}
+
+// OP_GET_PROPERTY on the instance on top of the stack when the first entry
+// of the site's cache is for another shape.
+static bool getProperty(VM* vm, int site) {
+  ObjInstance* instance = AS_INSTANCE(peek(vm, 0));
+  PropertyCache* cache = &vm->caches[site];
+  CacheEntry* entry = findEntry(cache, instance->shape);
+
+  int slot;
+  if (entry != NULL) {
+    slot = entry->slot;
+  } else {
+    ObjString* name = AS_STRING(vm->chunk->properties.values[site]);
+    slot = shapeSlot(instance->shape, name);
+    if (slot == -1) {
+      runtimeError(vm, "Undefined property '%s'.", name->chars);
+      return false;
     }
+    addEntry(cache, (CacheEntry){instance->shape, instance->shape, slot});
   }
 
-#undef READ_BYTE
-#undef READ_CONSTANT
-#undef BINARY_OP
+  vm->stackTop[-1] = instance->fields->values[slot];
+  return true;
 }
 
-InterpretResult interpret(const char* source) {
-  Chunk chunk;
-  initChunk(&chunk);
+// OP_SET_PROPERTY of the value on top of the stack into the instance below
+// it when the first entry of the site's cache is for another shape or adds
+// the field. An instance without the field gets it, which moves it to a new
+// shape and may need a bigger field array.
+static void setProperty(VM* vm, int site) {
+  ObjInstance* instance = AS_INSTANCE(peek(vm, 1));
+  Shape* shape = instance->shape;
+  PropertyCache* cache = &vm->caches[site];
+  CacheEntry* found = findEntry(cache, shape);
 
-  if (!compile(source, &chunk)) {
-    freeChunk(&chunk);
-    return INTERPRET_COMPILE_ERROR;
+  CacheEntry entry;
+  if (found != NULL) {
+    entry = *found;
+  } else {
+    ObjString* name = AS_STRING(vm->chunk->properties.values[site]);
+    int slot = shapeSlot(shape, name);
+    if (slot != -1) {
+      entry = (CacheEntry){shape, shape, slot};
+    } else {
+      Shape* newShape = shapeWithField(shape, name);
+      entry = (CacheEntry){shape, newShape, newShape->fieldCount - 1};
+    }
+    addEntry(cache, entry);
   }
 
-  vm.chunk = &chunk;
-  vm.ip = vm.chunk->code;
+  if (entry.newShape != shape) {
+    int capacity = instance->fields == NULL ? 0 : instance->fields->capacity;
+    if (capacity < entry.newShape->fieldCount) {
+      growFields(vm, GROW_CAPACITY(capacity));
+      instance = AS_INSTANCE(peek(vm, 1));
+    }
+    instance->shape = entry.newShape;
+  }
+  storeField(vm, instance->fields, entry.slot, peek(vm, 0));
+}
 
-  InterpretResult result = run();
+#define RUN_FUNCTION run
+#include "vm_run.h"
+#undef RUN_FUNCTION
 
-  freeChunk(&chunk);
-  return result;
+#define RUN_FUNCTION runProfiled
+#define PROFILE_DISPATCH
+#include "vm_run.h"
+#undef PROFILE_DISPATCH
+#undef RUN_FUNCTION
+
+static InterpretResult execute(VM* vm, Chunk* chunk, Value* result) {
+#ifdef BYTE_JIT
+  // Several VMs may share a chunk, so exactly the run that reaches the
+  // threshold compiles it.
+  if (!instrumented(vm)) {
+    JitFunction native =
+        (JitFunction)__atomic_load_n(&chunk->jitCode, __ATOMIC_ACQUIRE);
+    if (native == NULL &&
+        __atomic_add_fetch(&chunk->runCount, 1, __ATOMIC_RELAXED) ==
+            JIT_THRESHOLD &&
+        jitCompile(chunk)) {
+      native = (JitFunction)chunk->jitCode;
+    }
+    if (native != NULL && native(vm->inputs, result)) return INTERPRET_OK;
+  }
+#endif
+
+  resetStack(vm);
+  // Every run starts with its globals undefined, except that a REPL line
+  // keeps those of the lines before it.
+  int kept = 0;
+  if (vm->lineCount > 0) {
+    kept = vm->globalCount;
+  } else if (vm->heap.strings.count > 0) {
+    // Nothing the last run made is reachable any more; see finishString().
+    clearInternedStrings(&vm->heap.strings);
+  }
+  for (int i = kept; i < chunk->globals.count; i++) {
+    vm->globals[i] = EMPTY_VAL;
+  }
+  vm->globalCount = chunk->globals.count;
+  // The caches may hold what the sites of another chunk learned.
+  if (chunk->properties.count > 0) {
+    memset(vm->caches, 0,
+           sizeof(PropertyCache) * (size_t)chunk->properties.count);
+  }
+  vm->chunk = chunk;
+  vm->ip = chunk->code;
+
+  InterpretResult status;
+  if (!instrumented(vm)) {
+    status = run(vm);
+  } else {
+    status = runProfiled(vm);
+    if (vm->profile != NULL) endProfile(vm->profile);
+    if (vm->counters != NULL) endInstructionCounts(vm->counters);
+  }
+  endMarking(vm);
+
+  if (status != INTERPRET_OK) return status;
+
+  *result = pop(vm);
+  // The result stays valid until the next run, even once its chunk is gone.
+  if (IS_STRING(*result) && AS_OBJ(*result)->generation == GEN_PERMANENT) {
+    holdString(vm, AS_STRING(*result));
+  }
+  return status;
+}
+
+// Runs chunk and stores the value it returns in result. The stack, globals
+// and caches only grow when chunk needs a deeper stack, more globals or more
+// property sites than the VM has had so far. The objects chunk creates live
+// in the VM's heap; see Heap.
+InterpretResult executeChunk(VM* vm, Chunk* chunk, Value* result) {
+  // Only verified chunks are known not to overrun the stack.
+  if (chunk->maxStack == 0) {
+    fprintf(stderr, "Chunk has not been verified.\n");
+    return INTERPRET_RUNTIME_ERROR;
+  }
+  if (vm->stackCapacity < chunk->maxStack) {
+    vm->stack =
+        GROW_ARRAY(Value, vm->stack, vm->stackCapacity, chunk->maxStack);
+    vm->stackCapacity = chunk->maxStack;
+  }
+  if (vm->globalCapacity < chunk->globals.count) {
+    vm->globals = GROW_ARRAY(Value, vm->globals, vm->globalCapacity,
+                             chunk->globals.count);
+    vm->globalCapacity = chunk->globals.count;
+  }
+  if (vm->cacheCapacity < chunk->properties.count) {
+    vm->caches = GROW_ARRAY(PropertyCache, vm->caches, vm->cacheCapacity,
+                            chunk->properties.count);
+    vm->cacheCapacity = chunk->properties.count;
+  }
+
+  if (vm->counters == NULL) return execute(vm, chunk, result);
+
+  beginPhase(vm->counters);
+  InterpretResult status = execute(vm, chunk, result);
+  endPhase(vm->counters, PHASE_RUN);
+  return status;
+}
+
+// Runs chunk and prints the value it returns.
+InterpretResult interpretChunk(VM* vm, Chunk* chunk) {
+  Value value;
+  InterpretResult status = executeChunk(vm, chunk, &value);
+  if (status != INTERPRET_OK) return status;
+
+  // Keep the value and its newline together when VMs on other threads print
+  // at the same time.
+  flockfile(stdout);
+  printValue(value);
+  printf("\n");
+  funlockfile(stdout);
+  return status;
+}
+
+// Compiles source like compileWithGlobals(), which globals may be NULL for.
+// When vm counts hardware events, first tokenizes source on its own so the
+// scanner gets a phase of its own; the compile phase includes scanning again.
+bool compileSource(VM* vm, const char* source, Chunk* chunk,
+                   const ValueArray* globals) {
+  if (vm->counters == NULL) return compileWithGlobals(source, chunk, globals);
+
+  Scanner scanner;
+  initScanner(&scanner, source);
+  beginPhase(vm->counters);
+  while (scanToken(&scanner).type != TOKEN_EOF) continue;
+  endPhase(vm->counters, PHASE_SCAN);
+
+  beginPhase(vm->counters);
+  bool compiled = compileWithGlobals(source, chunk, globals);
+  endPhase(vm->counters, PHASE_COMPILE);
+  return compiled;
+}
+
+// Compiles and runs one line of a REPL session and prints its value. The
+// globals of the earlier lines stay declared, in the same slots, and keep
+// their values. Only run other chunks on a VM that has never run a line.
+InterpretResult interpretLine(VM* vm, const char* source) {
+  Chunk* chunk = ALLOCATE(Chunk, 1);
+  initChunk(chunk);
+  const ValueArray* globals =
+      vm->lineCount > 0 ? &vm->lines[vm->lineCount - 1]->globals : NULL;
+  if (!compileSource(vm, source, chunk, globals)) {
+    freeChunk(chunk);
+    FREE(Chunk, chunk);
+    return INTERPRET_COMPILE_ERROR;
+  }
+
+  if (vm->lineCapacity < vm->lineCount + 1) {
+    int oldCapacity = vm->lineCapacity;
+    vm->lineCapacity = GROW_CAPACITY(oldCapacity);
+    vm->lines =
+        GROW_ARRAY(Chunk*, vm->lines, oldCapacity, vm->lineCapacity);
+  }
+  vm->lines[vm->lineCount++] = chunk;
+  return interpretChunk(vm, chunk);
 }
@@ -2,15 +2,67 @@
 #define BYTE_VM_H
 
 #include "core/chunk.h"
+#include "core/shape.h"
 #include "core/value.h"
+#include "debug/counters.h"
+#include "debug/profiler.h"
+#include "utils/memory.h"
 
-#define STACK_MAX 256
+// How many shapes one property access site remembers. Sites that see more
+// are left to look every access up.
+#define CACHE_WAYS 4
 
+// What a site learned about instances of one shape: the slot of its field,
+// and for a store that adds the field, the shape that moves the instance to.
 typedef struct {
+  Shape* shape;     // NULL in an unused entry.
+  Shape* newShape;  // shape itself unless the store adds the field.
+  int slot;
+} CacheEntry;
+
+// The inline cache of one OP_GET_PROPERTY or OP_SET_PROPERTY. Entries fill
+// in the order shapes are seen, and an access that finds its shape in the
+// first needs no more than that comparison before it reads the slot.
+typedef struct {
+  CacheEntry entries[CACHE_WAYS];
+} PropertyCache;
+
+// One interpreter instance; each thread can run its own. VMs share only the
+// chunks they run, which they change atomically when quickening or compiling
+// them, and the permanent strings, whose intern table they read under a read
+// lock; see finishString().
+typedef struct VM {
   Chunk* chunk;
   uint8_t* ip;
-  Value stack[STACK_MAX];
+  // Grown to the maxStack of each chunk before it runs, so pushes need no
+  // bounds check.
+  Value* stack;
+  int stackCapacity;
   Value* stackTop;
+  // One slot per global of the running chunk, EMPTY_VAL until assigned.
+  Value* globals;
+  int globalCount;
+  int globalCapacity;
+  // The chunks of the REPL lines run so far, see interpretLine(). Globals
+  // keep their values from one line to the next and may hold constants of
+  // any line, so every line is kept as long as the VM.
+  Chunk** lines;
+  int lineCount;
+  int lineCapacity;
+  // One per property access site of the running chunk, emptied before each
+  // run. They live here rather than in the chunk, which other VMs may be
+  // running, because shapes belong to a VM.
+  PropertyCache* caches;
+  int cacheCapacity;
+  Shape* shapes;  // The root of this VM's shape tree.
+  // Values for OP_GET_INPUT, supplied by whoever runs a chunk compiled with
+  // compileWithInputs().
+  const Value* inputs;
+  Profile* profile;    // NULL unless profiling.
+  Counters* counters;  // NULL unless counting hardware events.
+  // The objects this VM creates. A returned object stays valid until the VM
+  // runs again.
+  Heap heap;
 } VM;
 
 typedef enum {
@@ -19,11 +71,18 @@ typedef enum {
   INTERPRET_RUNTIME_ERROR
 } InterpretResult;
 
-void initVM();
-void freeVM();
+VM* newVM();
+void freeVM(VM* vm);
 
-InterpretResult interpret(const char* source);
-void push(Value value);
-Value pop();
+bool compileSource(VM* vm, const char* source, Chunk* chunk,
+                   const ValueArray* globals);
+InterpretResult interpretLine(VM* vm, const char* source);
+InterpretResult interpretChunk(VM* vm, Chunk* chunk);
+InterpretResult executeChunk(VM* vm, Chunk* chunk, Value* result);
+void setProfile(VM* vm, Profile* profile);
+void setCounters(VM* vm, Counters* counters);
+void setConcurrentGC(VM* vm, bool concurrent);
+void push(VM* vm, Value value);
+Value pop(VM* vm);
 
 #endif
@@ -0,0 +1,442 @@
+// The body of the interpreter loop. This is not an ordinary header: vm.c
+// includes it once per variant of run() it needs, with RUN_FUNCTION naming
+// the function to define and PROFILE_DISPATCH selecting the instrumented
+// variant. Keeping the profiler in its own copy of the loop means the plain
+// loop pays nothing for it.
+
+static InterpretResult RUN_FUNCTION(VM* vm) {
+#define READ_BYTE() (*vm->ip++)
+#define READ_OPCODE() loadOpcode(vm->ip++)
+#define READ_SHORT() (vm->ip += 2, (uint16_t)((vm->ip[-2] << 8) | vm->ip[-1]))
+#define READ_CONSTANT() (vm->chunk->constants.values[READ_BYTE()])
+#define READ_CONSTANT_LONG()                                     \
+  (vm->ip += 3, vm->chunk->constants.values[(vm->ip[-3] << 16) | \
+                                            (vm->ip[-2] << 8) |  \
+                                            vm->ip[-1]])
+#define BINARY_OP(valueType, op)                              \
+  do {                                                        \
+    if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) { \
+      runtimeError(vm, "Operators must be number.");          \
+      return INTERPRET_RUNTIME_ERROR;                         \
+    }                                                         \
+    double b = AS_NUMBER(pop(vm));                            \
+    double a = AS_NUMBER(pop(vm));                            \
+    push(vm, valueType(a op b));                              \
+  } while (false)
+// The generic form of a quickenable instruction: quickens it when both
+// operands are numbers, then does the checked operation.
+#define QUICKENING_OP(valueType, op, quickened)             \
+  do {                                                      \
+    if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1))) { \
+      storeOpcode(&vm->ip[-1], (quickened));                \
+    }                                                       \
+    BINARY_OP(valueType, op);                               \
+  } while (false)
+// The quickened form works on the stack in place. If an operand is not a
+// number it puts the generic instruction back and jumps straight into its
+// handler, which also raises any error. Going around DISPATCH() keeps the
+// instruction from being traced and profiled twice.
+#define NUMBER_OP(valueType, op, generic)                       \
+  do {                                                          \
+    Value b = vm->stackTop[-1];                                 \
+    Value a = vm->stackTop[-2];                                 \
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) {                       \
+      storeOpcode(&vm->ip[-1], OP_##generic);                   \
+      goto GENERIC(generic);                                    \
+    }                                                           \
+    vm->stackTop[-2] = valueType(AS_NUMBER(a) op AS_NUMBER(b)); \
+    vm->stackTop--;                                             \
+  } while (false)
+// Labels the handler of a generic instruction, for NUMBER_OP to enter.
+#define GENERIC(name) generic_##name
+#define BINARY_OP_CONST(valueType, op)               \
+  do {                                               \
+    double b = AS_NUMBER(READ_CONSTANT());           \
+    if (!IS_NUMBER(peek(vm, 0))) {                   \
+      runtimeError(vm, "Operators must be number."); \
+      return INTERPRET_RUNTIME_ERROR;                \
+    }                                                \
+    double a = AS_NUMBER(pop(vm));                   \
+    push(vm, valueType(a op b));                     \
+  } while (false)
+// The fused comparisons negate the opposite comparison, exactly like the pair
+// they replace, so NaN operands still compare the same way.
+#define NOT_BOOL_VAL(value) BOOL_VAL(!(value))
+
+#ifdef DEBUG_TRACE_EXECUTION
+#define TRACE_INSTRUCTION()                                             \
+  do {                                                                  \
+    printf("          ");                                               \
+    for (Value* slot = vm->stack; slot < vm->stackTop; slot++) {        \
+      printf("[ ");                                                     \
+      printValue(*slot);                                                \
+      printf(" ]");                                                     \
+    }                                                                   \
+    printf("\n");                                                       \
+    disassembleInstruction(vm->chunk, (int)(vm->ip - vm->chunk->code)); \
+  } while (false)
+#else
+#define TRACE_INSTRUCTION() \
+  do {                      \
+  } while (false)
+#endif
+
+#ifdef PROFILE_DISPATCH
+#define PROFILE_INSTRUCTION() instrumentInstruction(vm)
+#else
+#define PROFILE_INSTRUCTION() \
+  do {                        \
+  } while (false)
+#endif
+
+#ifdef BYTE_COMPUTED_GOTO
+  // Every handler ends with its own indirect jump to the next one, which
+  // gives the branch predictor one history slot per opcode instead of one
+  // for the whole loop.
+  static void* dispatchTable[] = {
+      [OP_CONSTANT] = &&op_CONSTANT,
+      [OP_CONSTANT_LONG] = &&op_CONSTANT_LONG,
+      [OP_NIL] = &&op_NIL,
+      [OP_TRUE] = &&op_TRUE,
+      [OP_FALSE] = &&op_FALSE,
+      [OP_GET_INPUT] = &&op_GET_INPUT,
+      [OP_GET_GLOBAL] = &&op_GET_GLOBAL,
+      [OP_SET_GLOBAL] = &&op_SET_GLOBAL,
+      [OP_POP] = &&op_POP,
+      [OP_GET_LOCAL] = &&op_GET_LOCAL,
+      [OP_SET_LOCAL] = &&op_SET_LOCAL,
+      [OP_POPN] = &&op_POPN,
+      [OP_FOR_RANGE] = &&op_FOR_RANGE,
+      [OP_FOR_LOOP] = &&op_FOR_LOOP,
+      [OP_CLASS] = &&op_CLASS,
+      [OP_CALL] = &&op_CALL,
+      [OP_GET_PROPERTY] = &&op_GET_PROPERTY,
+      [OP_SET_PROPERTY] = &&op_SET_PROPERTY,
+      [OP_EQUAL] = &&op_EQUAL,
+      [OP_GREATER] = &&op_GREATER,
+      [OP_LESS] = &&op_LESS,
+      [OP_ADD] = &&op_ADD,
+      [OP_SUBTRACT] = &&op_SUBTRACT,
+      [OP_MULTIPLY] = &&op_MULTIPLY,
+      [OP_DIVIDE] = &&op_DIVIDE,
+      [OP_NOT] = &&op_NOT,
+      [OP_NEGATE] = &&op_NEGATE,
+      [OP_RETURN] = &&op_RETURN,
+      [OP_NOT_EQUAL] = &&op_NOT_EQUAL,
+      [OP_GREATER_EQUAL] = &&op_GREATER_EQUAL,
+      [OP_LESS_EQUAL] = &&op_LESS_EQUAL,
+      [OP_ADD_CONST] = &&op_ADD_CONST,
+      [OP_SUBTRACT_CONST] = &&op_SUBTRACT_CONST,
+      [OP_MULTIPLY_CONST] = &&op_MULTIPLY_CONST,
+      [OP_DIVIDE_CONST] = &&op_DIVIDE_CONST,
+      [OP_ADD_NUM] = &&op_ADD_NUM,
+      [OP_SUBTRACT_NUM] = &&op_SUBTRACT_NUM,
+      [OP_MULTIPLY_NUM] = &&op_MULTIPLY_NUM,
+      [OP_DIVIDE_NUM] = &&op_DIVIDE_NUM,
+      [OP_GREATER_NUM] = &&op_GREATER_NUM,
+      [OP_LESS_NUM] = &&op_LESS_NUM,
+      [OP_GREATER_EQUAL_NUM] = &&op_GREATER_EQUAL_NUM,
+      [OP_LESS_EQUAL_NUM] = &&op_LESS_EQUAL_NUM,
+  };
+
+#define INTERPRET_LOOP DISPATCH();
+#define CASE(name) op_##name
+#define DISPATCH()                                    \
+  do {                                                \
+    TRACE_INSTRUCTION();                              \
+    PROFILE_INSTRUCTION();                            \
+    goto* dispatchTable[instruction = READ_OPCODE()]; \
+  } while (false)
+#else
+#define INTERPRET_LOOP   \
+  loop:                  \
+  TRACE_INSTRUCTION();   \
+  PROFILE_INSTRUCTION(); \
+  switch (instruction = READ_OPCODE())
+#define CASE(name) case OP_##name
+#define DISPATCH() goto loop
+#endif
+
+  uint8_t instruction;
+  INTERPRET_LOOP {
+    CASE(CONSTANT): {
+      Value constant = READ_CONSTANT();
+      push(vm, constant);
+      DISPATCH();
+    }
+    CASE(CONSTANT_LONG): {
+      Value constant = READ_CONSTANT_LONG();
+      push(vm, constant);
+      DISPATCH();
+    }
+    CASE(NIL): {
+      push(vm, NIL_VAL);
+      DISPATCH();
+    }
+    CASE(TRUE): {
+      push(vm, BOOL_VAL(true));
+      DISPATCH();
+    }
+    CASE(FALSE): {
+      push(vm, BOOL_VAL(false));
+      DISPATCH();
+    }
+    CASE(GET_INPUT): {
+      push(vm, vm->inputs[READ_BYTE()]);
+      DISPATCH();
+    }
+    CASE(GET_GLOBAL): {
+      uint8_t slot = READ_BYTE();
+      Value value = vm->globals[slot];
+      if (IS_EMPTY(value)) {
+        runtimeError(vm, "Undefined variable '%s'.",
+                     AS_CSTRING(vm->chunk->globals.values[slot]));
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      push(vm, value);
+      DISPATCH();
+    }
+    CASE(SET_GLOBAL): {
+      vm->globals[READ_BYTE()] = peek(vm, 0);
+      DISPATCH();
+    }
+    CASE(POP): {
+      pop(vm);
+      DISPATCH();
+    }
+    CASE(GET_LOCAL): {
+      push(vm, vm->stack[READ_BYTE()]);
+      DISPATCH();
+    }
+    CASE(SET_LOCAL): {
+      vm->stack[READ_BYTE()] = peek(vm, 0);
+      DISPATCH();
+    }
+    CASE(POPN): {
+      vm->stackTop -= READ_BYTE();
+      DISPATCH();
+    }
+    CASE(FOR_RANGE): {
+      uint16_t offset = READ_SHORT();
+      Value start = vm->stackTop[-2];
+      Value limit = vm->stackTop[-1];
+      if (!IS_NUMBER(start) || !IS_NUMBER(limit)) {
+        runtimeError(vm, "Range bounds must be numbers.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      if (!inRange(AS_NUMBER(start)) || !inRange(AS_NUMBER(limit))) {
+        runtimeError(vm, "Range bounds must be less than 2^53 in magnitude.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      push(vm, start);
+      // Written so that a NaN bound runs the loop no times.
+      if (!(AS_NUMBER(start) <= AS_NUMBER(limit))) vm->ip += offset;
+      DISPATCH();
+    }
+    CASE(FOR_LOOP): {
+      uint16_t offset = READ_SHORT();
+      // OP_FOR_RANGE has checked both, and nothing else writes them.
+      double counter = AS_NUMBER(vm->stackTop[-3]) + 1;
+      if (counter <= AS_NUMBER(vm->stackTop[-2])) {
+        vm->stackTop[-3] = NUMBER_VAL(counter);
+        vm->stackTop[-1] = NUMBER_VAL(counter);
+        vm->ip -= offset;
+      }
+      DISPATCH();
+    }
+    CASE(CLASS): {
+      Value name = vm->chunk->constants.values[READ_SHORT()];
+      push(vm, OBJ_VAL(newClass(vm, AS_STRING(name))));
+      DISPATCH();
+    }
+    CASE(CALL): {
+      int argCount = READ_BYTE();
+      if (!IS_CLASS(peek(vm, argCount))) {
+        runtimeError(vm, "Can only call classes.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      // Classes have no initializer to take arguments yet.
+      if (argCount != 0) {
+        runtimeError(vm, "Expected 0 arguments but got %d.", argCount);
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      ObjInstance* instance = newInstance(vm, vm->shapes);
+      __atomic_store_n(&instance->klass, AS_CLASS(peek(vm, 0)),
+                       __ATOMIC_RELEASE);
+      vm->stackTop[-1] = OBJ_VAL(instance);
+      DISPATCH();
+    }
+    CASE(GET_PROPERTY): {
+      int site = READ_SHORT();
+      if (!IS_INSTANCE(peek(vm, 0))) {
+        runtimeError(vm, "Only instances have properties.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      ObjInstance* instance = AS_INSTANCE(peek(vm, 0));
+      CacheEntry* entry = &vm->caches[site].entries[0];
+      if (entry->shape == instance->shape) {
+        vm->stackTop[-1] = instance->fields->values[entry->slot];
+      } else if (!getProperty(vm, site)) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      DISPATCH();
+    }
+    CASE(SET_PROPERTY): {
+      int site = READ_SHORT();
+      if (!IS_INSTANCE(peek(vm, 1))) {
+        runtimeError(vm, "Only instances have fields.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      ObjInstance* instance = AS_INSTANCE(peek(vm, 1));
+      CacheEntry* entry = &vm->caches[site].entries[0];
+      if (entry->shape == instance->shape && entry->newShape == entry->shape) {
+        storeField(vm, instance->fields, entry->slot, peek(vm, 0));
+      } else {
+        setProperty(vm, site);
+      }
+      Value value = pop(vm);
+      vm->stackTop[-1] = value;
+      DISPATCH();
+    }
+    CASE(EQUAL): {
+      Value a = pop(vm);
+      Value b = pop(vm);
+      push(vm, BOOL_VAL(valuesEqual(a, b)));
+      DISPATCH();
+    }
+    CASE(GREATER):
+    GENERIC(GREATER): {
+      QUICKENING_OP(BOOL_VAL, >, OP_GREATER_NUM);
+      DISPATCH();
+    }
+    CASE(LESS):
+    GENERIC(LESS): {
+      QUICKENING_OP(BOOL_VAL, <, OP_LESS_NUM);
+      DISPATCH();
+    }
+    CASE(ADD):
+    GENERIC(ADD): {
+      if (IS_STRING(peek(vm, 0)) && IS_STRING(peek(vm, 1))) {
+        concatenate(vm);
+        DISPATCH();
+      }
+      QUICKENING_OP(NUMBER_VAL, +, OP_ADD_NUM);
+      DISPATCH();
+    }
+    CASE(SUBTRACT):
+    GENERIC(SUBTRACT): {
+      QUICKENING_OP(NUMBER_VAL, -, OP_SUBTRACT_NUM);
+      DISPATCH();
+    }
+    CASE(MULTIPLY):
+    GENERIC(MULTIPLY): {
+      QUICKENING_OP(NUMBER_VAL, *, OP_MULTIPLY_NUM);
+      DISPATCH();
+    }
+    CASE(DIVIDE):
+    GENERIC(DIVIDE): {
+      QUICKENING_OP(NUMBER_VAL, /, OP_DIVIDE_NUM);
+      DISPATCH();
+    }
+    CASE(NOT): {
+      push(vm, BOOL_VAL(isFalsy(pop(vm))));
+      DISPATCH();
+    }
+    CASE(NEGATE): {
+      if (!IS_NUMBER(peek(vm, 0))) {
+        runtimeError(vm, "Operand must be a number.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      push(vm, NUMBER_VAL(-AS_NUMBER(pop(vm))));
+      DISPATCH();
+    }
+    CASE(RETURN): {
+      // The result stays on the stack for executeChunk() to take.
+      return INTERPRET_OK;
+    }
+    CASE(NOT_EQUAL): {
+      Value a = pop(vm);
+      Value b = pop(vm);
+      push(vm, BOOL_VAL(!valuesEqual(a, b)));
+      DISPATCH();
+    }
+    CASE(GREATER_EQUAL):
+    GENERIC(GREATER_EQUAL): {
+      QUICKENING_OP(NOT_BOOL_VAL, <, OP_GREATER_EQUAL_NUM);
+      DISPATCH();
+    }
+    CASE(LESS_EQUAL):
+    GENERIC(LESS_EQUAL): {
+      QUICKENING_OP(NOT_BOOL_VAL, >, OP_LESS_EQUAL_NUM);
+      DISPATCH();
+    }
+    CASE(ADD_CONST): {
+      BINARY_OP_CONST(NUMBER_VAL, +);
+      DISPATCH();
+    }
+    CASE(SUBTRACT_CONST): {
+      BINARY_OP_CONST(NUMBER_VAL, -);
+      DISPATCH();
+    }
+    CASE(MULTIPLY_CONST): {
+      BINARY_OP_CONST(NUMBER_VAL, *);
+      DISPATCH();
+    }
+    CASE(DIVIDE_CONST): {
+      BINARY_OP_CONST(NUMBER_VAL, /);
+      DISPATCH();
+    }
+    CASE(ADD_NUM): {
+      NUMBER_OP(NUMBER_VAL, +, ADD);
+      DISPATCH();
+    }
+    CASE(SUBTRACT_NUM): {
+      NUMBER_OP(NUMBER_VAL, -, SUBTRACT);
+      DISPATCH();
+    }
+    CASE(MULTIPLY_NUM): {
+      NUMBER_OP(NUMBER_VAL, *, MULTIPLY);
+      DISPATCH();
+    }
+    CASE(DIVIDE_NUM): {
+      NUMBER_OP(NUMBER_VAL, /, DIVIDE);
+      DISPATCH();
+    }
+    CASE(GREATER_NUM): {
+      NUMBER_OP(BOOL_VAL, >, GREATER);
+      DISPATCH();
+    }
+    CASE(LESS_NUM): {
+      NUMBER_OP(BOOL_VAL, <, LESS);
+      DISPATCH();
+    }
+    CASE(GREATER_EQUAL_NUM): {
+      NUMBER_OP(NOT_BOOL_VAL, <, GREATER_EQUAL);
+      DISPATCH();
+    }
+    CASE(LESS_EQUAL_NUM): {
+      NUMBER_OP(NOT_BOOL_VAL, >, LESS_EQUAL);
+      DISPATCH();
+    }
+  }
+
+  // Only reachable with an opcode the compiler never emits.
+  return INTERPRET_RUNTIME_ERROR;
+
+#undef READ_BYTE
+#undef READ_OPCODE
+#undef READ_SHORT
+#undef READ_CONSTANT
+#undef READ_CONSTANT_LONG
+#undef BINARY_OP
+#undef QUICKENING_OP
+#undef NUMBER_OP
+#undef GENERIC
+#undef BINARY_OP_CONST
+#undef NOT_BOOL_VAL
+#undef TRACE_INSTRUCTION
+#undef PROFILE_INSTRUCTION
+#undef INTERPRET_LOOP
+#undef CASE
+#undef DISPATCH
+}
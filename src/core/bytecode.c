@@ -0,0 +1,305 @@
+#include "bytecode.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "object.h"
+#include "verifier.h"
+
+#ifdef BYTE_JIT
+#include "jit.h"
+#endif
+
+// File layout, in host byte order:
+//
+//   Header
+//   LineStart lines[lineCount]
+//   SerializedValue constants[constantCount]
+//   SerializedValue globals[globalCount]
+//   SerializedValue properties[propertyCount]
+//   char strings[stringBytes]
+//   uint8_t code[codeCount]
+//
+// Every section before the strings starts 8-byte aligned so the line table
+// can be used in place. String constants and the names of the globals and
+// properties point into the strings section.
+#define BYTECODE_MAGIC 0x43545942  // "BYTC" read as little-endian.
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sourceHash;
+  uint32_t codeCount;
+  uint32_t lineCount;
+  uint32_t constantCount;
+  uint32_t stringBytes;
+  uint32_t globalCount;
+  uint32_t propertyCount;
+} Header;
+
+typedef enum {
+  SERIALIZED_NIL,
+  SERIALIZED_FALSE,
+  SERIALIZED_TRUE,
+  SERIALIZED_NUMBER,
+  SERIALIZED_STRING,
+} SerializedType;
+
+typedef struct {
+  uint32_t type;
+  uint32_t length;  // Of a string.
+  union {
+    double number;
+    uint64_t offset;  // Of a string, into the strings section.
+  } as;
+} SerializedValue;
+
+// 64-bit FNV-1a.
+uint64_t hashSource(const char* source, size_t length) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= (uint8_t)source[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Strings are laid out in the order of the values, constants first, then the
+// globals and the properties, so stringOffset is the running total of the
+// lengths before this one.
+static SerializedValue serializeValue(Value value, uint64_t stringOffset) {
+  SerializedValue serialized = {SERIALIZED_NIL, 0, {.offset = 0}};
+  if (IS_BOOL(value)) {
+    serialized.type = AS_BOOL(value) ? SERIALIZED_TRUE : SERIALIZED_FALSE;
+  } else if (IS_NUMBER(value)) {
+    serialized.type = SERIALIZED_NUMBER;
+    serialized.as.number = AS_NUMBER(value);
+  } else if (IS_STRING(value)) {
+    serialized.type = SERIALIZED_STRING;
+    serialized.length = (uint32_t)AS_STRING(value)->length;
+    serialized.as.offset = stringOffset;
+  }
+  return serialized;
+}
+
+static bool deserializeValue(SerializedValue* serialized, const char* strings,
+                             uint32_t stringBytes, Value* value) {
+  switch (serialized->type) {
+    case SERIALIZED_NIL:
+      *value = NIL_VAL;
+      return true;
+    case SERIALIZED_FALSE:
+      *value = BOOL_VAL(false);
+      return true;
+    case SERIALIZED_TRUE:
+      *value = BOOL_VAL(true);
+      return true;
+    case SERIALIZED_NUMBER:
+      *value = NUMBER_VAL(serialized->as.number);
+      return true;
+    case SERIALIZED_STRING:
+      if (serialized->as.offset > stringBytes ||
+          serialized->length > stringBytes - serialized->as.offset) {
+        return false;
+      }
+      *value = OBJ_VAL(copyString(strings + serialized->as.offset,
+                                  (int)serialized->length));
+      return true;
+    default:
+      return false;
+  }
+}
+
+static uint64_t stringBytesOf(ValueArray* values) {
+  uint64_t bytes = 0;
+  for (int i = 0; i < values->count; i++) {
+    Value value = values->values[i];
+    if (IS_STRING(value)) bytes += (uint64_t)AS_STRING(value)->length;
+  }
+  return bytes;
+}
+
+static bool writeValues(ValueArray* values, uint64_t* stringOffset,
+                        FILE* out) {
+  for (int i = 0; i < values->count; i++) {
+    SerializedValue value = serializeValue(values->values[i], *stringOffset);
+    *stringOffset += value.type == SERIALIZED_STRING ? value.length : 0;
+    if (fwrite(&value, sizeof(SerializedValue), 1, out) != 1) return false;
+  }
+  return true;
+}
+
+static bool writeStrings(ValueArray* values, FILE* out) {
+  for (int i = 0; i < values->count; i++) {
+    Value value = values->values[i];
+    if (!IS_STRING(value)) continue;
+    ObjString* string = AS_STRING(value);
+    if (fwrite(string->chars, 1, string->length, out) !=
+        (size_t)string->length) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool writeBytecode(Chunk* chunk, uint64_t sourceHash, const char* path) {
+  // Write to a private temporary file and rename it over the destination, so
+  // a concurrent reader never maps a half-written file. mkstemp() keeps the
+  // name unique between threads of one process as well. It creates the file
+  // 0600, so widen that to what fopen() would have given.
+  size_t pathLength = strlen(path);
+  char* tempPath = ALLOCATE(char, pathLength + 32);
+  snprintf(tempPath, pathLength + 32, "%s.XXXXXX", path);
+
+  int fd = mkstemp(tempPath);
+  if (fd >= 0) fchmod(fd, 0644);
+  FILE* out = fd < 0 ? NULL : fdopen(fd, "wb");
+  if (out == NULL) {
+    if (fd >= 0) {
+      close(fd);
+      remove(tempPath);
+    }
+    FREE_ARRAY(char, tempPath, pathLength + 32);
+    return false;
+  }
+
+  uint64_t stringBytes = stringBytesOf(&chunk->constants) +
+                         stringBytesOf(&chunk->globals) +
+                         stringBytesOf(&chunk->properties);
+
+  Header header = {
+      .magic = BYTECODE_MAGIC,
+      .version = BYTECODE_VERSION,
+      .sourceHash = sourceHash,
+      .codeCount = (uint32_t)chunk->count,
+      .lineCount = (uint32_t)chunk->lineCount,
+      .constantCount = (uint32_t)chunk->constants.count,
+      .stringBytes = (uint32_t)stringBytes,
+      .globalCount = (uint32_t)chunk->globals.count,
+      .propertyCount = (uint32_t)chunk->properties.count,
+  };
+
+  bool ok = stringBytes <= UINT32_MAX;
+  ok = ok && fwrite(&header, sizeof(Header), 1, out) == 1;
+  ok = ok && fwrite(chunk->lines, sizeof(LineStart), chunk->lineCount, out) ==
+                 (size_t)chunk->lineCount;
+  uint64_t stringOffset = 0;
+  ok = ok && writeValues(&chunk->constants, &stringOffset, out);
+  ok = ok && writeValues(&chunk->globals, &stringOffset, out);
+  ok = ok && writeValues(&chunk->properties, &stringOffset, out);
+  ok = ok && writeStrings(&chunk->constants, out);
+  ok = ok && writeStrings(&chunk->globals, out);
+  ok = ok && writeStrings(&chunk->properties, out);
+  ok = ok && fwrite(chunk->code, 1, chunk->count, out) == (size_t)chunk->count;
+  ok = fclose(out) == 0 && ok;
+
+  if (ok) ok = rename(tempPath, path) == 0;
+  if (!ok) remove(tempPath);
+
+  FREE_ARRAY(char, tempPath, pathLength + 32);
+  return ok;
+}
+
+bool loadBytecode(BytecodeFile* file, const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) {
+    close(fd);
+    return false;
+  }
+
+  size_t size = (size_t)st.st_size;
+  // Writable so the VM can quicken instructions in place. The mapping is
+  // private, so those writes never reach the file.
+  void* mapping =
+      mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) return false;
+
+  Header* header = (Header*)mapping;
+  size_t linesSize = (size_t)header->lineCount * sizeof(LineStart);
+  size_t valuesSize = ((size_t)header->constantCount + header->globalCount +
+                       header->propertyCount) *
+                      sizeof(SerializedValue);
+  if (header->magic != BYTECODE_MAGIC ||
+      header->version != BYTECODE_VERSION || header->codeCount == 0 ||
+      header->lineCount == 0 || header->globalCount > MAX_GLOBALS ||
+      header->propertyCount > MAX_PROPERTY_SITES ||
+      size != sizeof(Header) + linesSize + valuesSize + header->stringBytes +
+                  header->codeCount) {
+    munmap(mapping, size);
+    return false;
+  }
+
+  uint8_t* base = (uint8_t*)mapping;
+  LineStart* lines = (LineStart*)(base + sizeof(Header));
+  SerializedValue* constants =
+      (SerializedValue*)(base + sizeof(Header) + linesSize);
+  SerializedValue* globals = constants + header->constantCount;
+  SerializedValue* properties = globals + header->globalCount;
+  const char* strings =
+      (const char*)(base + sizeof(Header) + linesSize + valuesSize);
+  uint8_t* code = (uint8_t*)strings + header->stringBytes;
+
+  Chunk* chunk = &file->chunk;
+  initChunk(chunk);
+  bool ok = true;
+  for (uint32_t i = 0; ok && i < header->constantCount; i++) {
+    Value value;
+    ok = deserializeValue(&constants[i], strings, header->stringBytes,
+                          &value);
+    if (ok) writeValueArray(&chunk->constants, value);
+  }
+  // Runtime errors print the names, and shapes compare field names by
+  // pointer, so they had better be interned strings.
+  for (uint32_t i = 0; ok && i < header->globalCount; i++) {
+    Value value;
+    ok = globals[i].type == SERIALIZED_STRING &&
+         deserializeValue(&globals[i], strings, header->stringBytes, &value);
+    if (ok) writeValueArray(&chunk->globals, value);
+  }
+  for (uint32_t i = 0; ok && i < header->propertyCount; i++) {
+    Value value;
+    ok = properties[i].type == SERIALIZED_STRING &&
+         deserializeValue(&properties[i], strings, header->stringBytes,
+                          &value);
+    if (ok) writeValueArray(&chunk->properties, value);
+  }
+
+  // Borrowed from the mapping, which is why freeChunk() must not see them.
+  chunk->code = code;
+  chunk->count = (int)header->codeCount;
+  chunk->lines = lines;
+  chunk->lineCount = (int)header->lineCount;
+
+  // The file may have been damaged or written by something other than the
+  // compiler, and the VM trusts whatever it runs.
+  if (!ok || !verifyChunk(chunk, 0)) {
+    freeChunkValues(chunk);
+    munmap(mapping, size);
+    return false;
+  }
+
+  file->sourceHash = header->sourceHash;
+  file->mapping = mapping;
+  file->size = size;
+  return true;
+}
+
+void unloadBytecode(BytecodeFile* file) {
+  freeChunkValues(&file->chunk);
+#ifdef BYTE_JIT
+  jitFree(&file->chunk);
+#endif
+  munmap(file->mapping, file->size);
+  file->mapping = NULL;
+  file->size = 0;
+}
@@ -0,0 +1,28 @@
+#ifndef BYTE_BYTECODE_H
+#define BYTE_BYTECODE_H
+
+#include "chunk.h"
+#include "common.h"
+
+// Bump whenever the opcode set, an operand encoding or the file layout
+// changes, so stale cache files are recompiled instead of misread.
+#define BYTECODE_VERSION 8
+
+// A chunk loaded from a .bytec file. The code and line table point straight
+// into a private mapping of the file; only the constants and the names of the
+// globals and properties are decoded. Loading verifies the chunk, see
+// verifier.h.
+// Release it with unloadBytecode(), never freeChunk().
+typedef struct {
+  Chunk chunk;
+  uint64_t sourceHash;
+  void* mapping;
+  size_t size;
+} BytecodeFile;
+
+uint64_t hashSource(const char* source, size_t length);
+bool writeBytecode(Chunk* chunk, uint64_t sourceHash, const char* path);
+bool loadBytecode(BytecodeFile* file, const char* path);
+void unloadBytecode(BytecodeFile* file);
+
+#endif
@@ -1,13 +1,100 @@
 #include "chunk.h"
 #include "common.h"
 #include "memory.h"
+#include "object.h"
+
+#ifdef BYTE_JIT
+#include "jit.h"
+#endif
+
+const OpInfo opInfo[] = {
+    [OP_CONSTANT] = {"OP_CONSTANT", 1, 0, 1},
+    [OP_CONSTANT_LONG] = {"OP_CONSTANT_LONG", 3, 0, 1},
+    [OP_NIL] = {"OP_NIL", 0, 0, 1},
+    [OP_TRUE] = {"OP_TRUE", 0, 0, 1},
+    [OP_FALSE] = {"OP_FALSE", 0, 0, 1},
+    [OP_GET_INPUT] = {"OP_GET_INPUT", 1, 0, 1},
+    [OP_GET_GLOBAL] = {"OP_GET_GLOBAL", 1, 0, 1},
+    [OP_SET_GLOBAL] = {"OP_SET_GLOBAL", 1, 1, 1},
+    [OP_POP] = {"OP_POP", 0, 1, 0},
+    [OP_GET_LOCAL] = {"OP_GET_LOCAL", 1, 0, 1},
+    [OP_SET_LOCAL] = {"OP_SET_LOCAL", 1, 1, 1},
+    [OP_POPN] = {"OP_POPN", 1, 0, 0},
+    [OP_FOR_RANGE] = {"OP_FOR_RANGE", 2, 2, 3},
+    [OP_FOR_LOOP] = {"OP_FOR_LOOP", 2, 3, 3},
+    [OP_CLASS] = {"OP_CLASS", 2, 0, 1},
+    [OP_CALL] = {"OP_CALL", 1, 1, 1},
+    [OP_GET_PROPERTY] = {"OP_GET_PROPERTY", 2, 1, 1},
+    [OP_SET_PROPERTY] = {"OP_SET_PROPERTY", 2, 2, 1},
+    [OP_EQUAL] = {"OP_EQUAL", 0, 2, 1},
+    [OP_GREATER] = {"OP_GREATER", 0, 2, 1},
+    [OP_LESS] = {"OP_LESS", 0, 2, 1},
+    [OP_ADD] = {"OP_ADD", 0, 2, 1},
+    [OP_SUBTRACT] = {"OP_SUBTRACT", 0, 2, 1},
+    [OP_MULTIPLY] = {"OP_MULTIPLY", 0, 2, 1},
+    [OP_DIVIDE] = {"OP_DIVIDE", 0, 2, 1},
+    [OP_NOT] = {"OP_NOT", 0, 1, 1},
+    [OP_NEGATE] = {"OP_NEGATE", 0, 1, 1},
+    [OP_RETURN] = {"OP_RETURN", 0, 1, 0},
+    [OP_NOT_EQUAL] = {"OP_NOT_EQUAL", 0, 2, 1},
+    [OP_GREATER_EQUAL] = {"OP_GREATER_EQUAL", 0, 2, 1},
+    [OP_LESS_EQUAL] = {"OP_LESS_EQUAL", 0, 2, 1},
+    [OP_ADD_CONST] = {"OP_ADD_CONST", 1, 1, 1},
+    [OP_SUBTRACT_CONST] = {"OP_SUBTRACT_CONST", 1, 1, 1},
+    [OP_MULTIPLY_CONST] = {"OP_MULTIPLY_CONST", 1, 1, 1},
+    [OP_DIVIDE_CONST] = {"OP_DIVIDE_CONST", 1, 1, 1},
+    [OP_ADD_NUM] = {"OP_ADD_NUM", 0, 2, 1},
+    [OP_SUBTRACT_NUM] = {"OP_SUBTRACT_NUM", 0, 2, 1},
+    [OP_MULTIPLY_NUM] = {"OP_MULTIPLY_NUM", 0, 2, 1},
+    [OP_DIVIDE_NUM] = {"OP_DIVIDE_NUM", 0, 2, 1},
+    [OP_GREATER_NUM] = {"OP_GREATER_NUM", 0, 2, 1},
+    [OP_LESS_NUM] = {"OP_LESS_NUM", 0, 2, 1},
+    [OP_GREATER_EQUAL_NUM] = {"OP_GREATER_EQUAL_NUM", 0, 2, 1},
+    [OP_LESS_EQUAL_NUM] = {"OP_LESS_EQUAL_NUM", 0, 2, 1},
+};
+
+const int opCount = sizeof(opInfo) / sizeof(opInfo[0]);
+
+// The generic instruction a quickened one was rewritten from, or the
+// instruction itself. Anything reading bytecode after it may have run should
+// look at instructions through this.
+OpCode unquickened(OpCode instruction) {
+  switch (instruction) {
+    case OP_ADD_NUM:
+      return OP_ADD;
+    case OP_SUBTRACT_NUM:
+      return OP_SUBTRACT;
+    case OP_MULTIPLY_NUM:
+      return OP_MULTIPLY;
+    case OP_DIVIDE_NUM:
+      return OP_DIVIDE;
+    case OP_GREATER_NUM:
+      return OP_GREATER;
+    case OP_LESS_NUM:
+      return OP_LESS;
+    case OP_GREATER_EQUAL_NUM:
+      return OP_GREATER_EQUAL;
+    case OP_LESS_EQUAL_NUM:
+      return OP_LESS_EQUAL;
+    default:
+      return instruction;
+  }
+}
 
 void initChunk(Chunk* chunk) {
   chunk->count = 0;
   chunk->capacity = 0;
   chunk->code = NULL;
+  chunk->lineCount = 0;
+  chunk->lineCapacity = 0;
   chunk->lines = NULL;
   initValueArray(&chunk->constants);
+  initValueArray(&chunk->globals);
+  initValueArray(&chunk->properties);
+  chunk->maxStack = 0;
+  chunk->runCount = 0;
+  chunk->jitCode = NULL;
+  chunk->jitSize = 0;
 }
 
 void writeChunk(Chunk* chunk, uint8_t byte, int line) {
@@ -16,22 +103,119 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line) {
     chunk->capacity = GROW_CAPACITY(oldCapacity);
     chunk->code =
         GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
-    chunk->lines = GROW_ARRAY(int, chunk->lines, oldCapacity, chunk->capacity);
   }
 
   chunk->code[chunk->count] = byte;
-  chunk->lines[chunk->count] = line;
   chunk->count++;
+
+  // Still on the line of the current run.
+  if (chunk->lineCount > 0 &&
+      chunk->lines[chunk->lineCount - 1].line == line) {
+    return;
+  }
+
+  if (chunk->lineCapacity < chunk->lineCount + 1) {
+    int oldCapacity = chunk->lineCapacity;
+    chunk->lineCapacity = GROW_CAPACITY(oldCapacity);
+    chunk->lines =
+        GROW_ARRAY(LineStart, chunk->lines, oldCapacity, chunk->lineCapacity);
+  }
+
+  LineStart* lineStart = &chunk->lines[chunk->lineCount++];
+  lineStart->offset = chunk->count - 1;
+  lineStart->line = line;
+}
+
+// Drops the references to the strings among values from start on. Every
+// string in a chunk is permanent, and the chunk owns one reference to it for
+// each time it appears.
+static void releaseStrings(ValueArray* values, int start) {
+  for (int i = start; i < values->count; i++) {
+    if (IS_STRING(values->values[i])) {
+      releaseString(AS_STRING(values->values[i]));
+    }
+  }
+}
+
+// Frees the constants and the names of the globals and properties, and with
+// them the strings no other chunk uses.
+void freeChunkValues(Chunk* chunk) {
+  releaseStrings(&chunk->constants, 0);
+  releaseStrings(&chunk->globals, 0);
+  releaseStrings(&chunk->properties, 0);
+  freeValueArray(&chunk->constants);
+  freeValueArray(&chunk->globals);
+  freeValueArray(&chunk->properties);
 }
 
 void freeChunk(Chunk* chunk) {
   FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-  FREE_ARRAY(int, chunk->lines, chunk->capacity);
-  freeValueArray(&chunk->constants);
+  FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+  freeChunkValues(chunk);
+#ifdef BYTE_JIT
+  jitFree(chunk);
+#endif
   initChunk(chunk);
 }
 
+// The chunk takes over the caller's reference if value is a string.
 int addConstant(Chunk* chunk, Value value) {
   writeValueArray(&chunk->constants, value);
   return chunk->constants.count - 1;
-}
\ No newline at end of file
+}
+
+// Drops everything written after the first `count` bytes of code and the first
+// `constantCount` constants, so the compiler can replace code it just emitted.
+void rewindChunk(Chunk* chunk, int count, int constantCount) {
+  releaseStrings(&chunk->constants, constantCount);
+  chunk->count = count;
+  chunk->constants.count = constantCount;
+
+  while (chunk->lineCount > 0 &&
+         chunk->lines[chunk->lineCount - 1].offset >= count) {
+    chunk->lineCount--;
+  }
+}
+
+int getLine(Chunk* chunk, int offset) {
+  // Binary search for the last run starting at or before offset.
+  int start = 0;
+  int end = chunk->lineCount - 1;
+
+  while (start < end) {
+    int mid = start + (end - start + 1) / 2;
+    if (chunk->lines[mid].offset <= offset) {
+      start = mid;
+    } else {
+      end = mid - 1;
+    }
+  }
+
+  return chunk->lines[start].line;
+}
+
+bool isJump(uint8_t instruction) {
+  return instruction == OP_FOR_RANGE || instruction == OP_FOR_LOOP;
+}
+
+// Where the jump at offset goes. The two-byte operand is the distance from
+// the end of the instruction, forward for OP_FOR_RANGE and back for
+// OP_FOR_LOOP. A damaged chunk may point anywhere, even before the start.
+int jumpTarget(Chunk* chunk, int offset) {
+  uint8_t* operand = &chunk->code[offset + 1];
+  int distance = (operand[0] << 8) | operand[1];
+  if (chunk->code[offset] == OP_FOR_LOOP) distance = -distance;
+  return offset + 3 + distance;
+}
+
+// Points the jump at offset to target. Returns false if that is too far,
+// or in the wrong direction, for the operand.
+bool setJumpTarget(Chunk* chunk, int offset, int target) {
+  int distance = target - (offset + 3);
+  if (chunk->code[offset] == OP_FOR_LOOP) distance = -distance;
+  if (distance < 0 || distance > UINT16_MAX) return false;
+
+  chunk->code[offset + 1] = (uint8_t)(distance >> 8);
+  chunk->code[offset + 2] = (uint8_t)distance;
+  return true;
+}
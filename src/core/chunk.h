@@ -5,11 +5,48 @@
 
 #include "value.h"
 
+// OP_CONSTANT_LONG addresses the pool with a 24-bit operand.
+#define MAX_CONSTANTS (1 << 24)
+// OP_GET_INPUT addresses inputs with a one-byte operand.
+#define MAX_INPUTS 256
+// So do OP_GET_GLOBAL and OP_SET_GLOBAL with global slots.
+#define MAX_GLOBALS 256
+// And OP_GET_LOCAL, OP_SET_LOCAL and OP_POPN with stack slots and counts.
+#define MAX_LOCALS 255
+// OP_GET_PROPERTY and OP_SET_PROPERTY number their sites with two bytes.
+#define MAX_PROPERTY_SITES (UINT16_MAX + 1)
+
 typedef enum {
   OP_CONSTANT,
+  OP_CONSTANT_LONG,
   OP_NIL,
   OP_TRUE,
   OP_FALSE,
+  OP_GET_INPUT,  // Pushes the input named by the identifier, see compiler.h.
+  OP_GET_GLOBAL,
+  OP_SET_GLOBAL,  // Leaves the assigned value on the stack.
+  OP_POP,
+  OP_GET_LOCAL,  // Reads a stack slot, counted from the bottom of the stack.
+  OP_SET_LOCAL,  // Leaves the assigned value on the stack.
+  OP_POPN,       // Pops as many values as its operand says.
+
+  // for i in start..limit, counting up by one with both bounds included.
+  // OP_FOR_RANGE checks the bounds below it and pushes the loop variable,
+  // then jumps forward past the loop if it runs no times. OP_FOR_LOOP ends
+  // the body: it counts, and while the limit is not passed it stores the
+  // count in the loop variable and jumps back. The counter and the limit
+  // are numbers in hidden slots below the loop variable, so the body may
+  // assign the variable without changing the iteration. Bounds must be
+  // below 2^53 in magnitude, past which adding one stops counting.
+  OP_FOR_RANGE,
+  OP_FOR_LOOP,
+
+  OP_CLASS,  // Creates a class named by a constant, two-byte index.
+  OP_CALL,   // Calls the value below the arguments its operand counts.
+  // Each property access is a site with a name and its own inline cache,
+  // both picked by the two-byte operand; see PropertyCache.
+  OP_GET_PROPERTY,
+  OP_SET_PROPERTY,  // Leaves the assigned value on the stack.
 
   OP_EQUAL,
   OP_GREATER,
@@ -23,20 +60,101 @@ typedef enum {
   OP_NOT,     // !
   OP_NEGATE,  // -
 
-  OP_RETURN
+  OP_RETURN,
+
+  // Superinstructions, only produced by the peephole pass.
+  OP_NOT_EQUAL,       // OP_EQUAL OP_NOT
+  OP_GREATER_EQUAL,   // OP_LESS OP_NOT
+  OP_LESS_EQUAL,      // OP_GREATER OP_NOT
+  OP_ADD_CONST,       // OP_CONSTANT k OP_ADD
+  OP_SUBTRACT_CONST,  // OP_CONSTANT k OP_SUBTRACT
+  OP_MULTIPLY_CONST,  // OP_CONSTANT k OP_MULTIPLY
+  OP_DIVIDE_CONST,    // OP_CONSTANT k OP_DIVIDE
+
+  // Quickened forms. The VM rewrites the generic instruction in place once
+  // it has seen number operands, and rewrites it back when that stops being
+  // true; see storeOpcode(). Never emitted by the compiler.
+  OP_ADD_NUM,
+  OP_SUBTRACT_NUM,
+  OP_MULTIPLY_NUM,
+  OP_DIVIDE_NUM,
+  OP_GREATER_NUM,
+  OP_LESS_NUM,
+  OP_GREATER_EQUAL_NUM,
+  OP_LESS_EQUAL_NUM,
 } OpCode;
 
+// Stack effect: an instruction needs `pops` values on the stack, takes them
+// off and then leaves `pushes` new ones. OP_POPN pops its operand instead,
+// and OP_CALL the callee and as many arguments as its operand says.
+typedef struct {
+  const char* name;
+  int operandBytes;
+  int pops;
+  int pushes;
+} OpInfo;
+
+// Indexed by OpCode.
+extern const OpInfo opInfo[];
+// Number of entries in opInfo, one more than the highest opcode.
+extern const int opCount;
+
+OpCode unquickened(OpCode instruction);
+
+// Quickening rewrites opcodes in chunks that other threads may be running,
+// compiling or disassembling at the same time, so every opcode read that can
+// overlap a run, and every rewrite, goes through these. An opcode only ever
+// changes between a generic instruction and its *_NUM form. Both take the
+// same operands and either runs correctly wherever the other would, so a
+// reader may see either, and nothing else is published along with the byte.
+static inline uint8_t loadOpcode(const uint8_t* code) {
+  return __atomic_load_n(code, __ATOMIC_RELAXED);
+}
+
+static inline void storeOpcode(uint8_t* code, uint8_t instruction) {
+  __atomic_store_n(code, instruction, __ATOMIC_RELAXED);
+}
+
+// Start of a run of bytecode compiled from the same source line. Runs are
+// stored in offset order and only begin when the line changes.
+typedef struct {
+  int offset;
+  int line;
+} LineStart;
+
 typedef struct {
   int count;
   int capacity;
   uint8_t* code;
-  int* lines;
+  int lineCount;
+  int lineCapacity;
+  LineStart* lines;
   ValueArray constants;
+  // The name of each global slot, as a string.
+  ValueArray globals;
+  // The name of the property each property access site reads or writes.
+  ValueArray properties;
+
+  // Deepest the stack gets while running the chunk, set by verifyChunk().
+  // Zero until the chunk has been verified.
+  int maxStack;
+
+  // Counts executions until the JIT compiles the chunk into jitCode, a
+  // JitFunction. Unused unless built with BYTE_JIT.
+  uint32_t runCount;
+  void* jitCode;
+  size_t jitSize;
 } Chunk;
 
 void initChunk(Chunk* chunk);
 void freeChunk(Chunk* chunk);
+void freeChunkValues(Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
 int addConstant(Chunk* chunk, Value value);
+void rewindChunk(Chunk* chunk, int count, int constantCount);
+int getLine(Chunk* chunk, int offset);
+bool isJump(uint8_t instruction);
+int jumpTarget(Chunk* chunk, int offset);
+bool setJumpTarget(Chunk* chunk, int offset, int target);
 
 #endif
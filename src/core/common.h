@@ -12,8 +12,20 @@
 #define _GNU_SOURCE 1
 #endif
 
+// BYTE_NAN_BOXING packs every Value into one 64-bit word (see value.h). It is
+// set by CMake; configure with -DBYTE_NAN_BOXING=OFF for the tagged union.
+
+// Disassembling every chunk and tracing every instruction dwarfs the cost of
+// the instructions themselves, so only debug builds do it.
+#ifdef DEBUG
 #define DEBUG_PRINT_CODE
 #define DEBUG_TRACE_EXECUTION
+#endif
+
+// Collect on every allocation, to flush out pointers the collector does not
+// know about, and log each collection.
+// #define DEBUG_STRESS_GC
+// #define DEBUG_LOG_GC
 
 #define BYTE_COPYRIGHT "Copyright (c) 2023 Saheb Giri"
 
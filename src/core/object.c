@@ -0,0 +1,230 @@
+#include "object.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "memory.h"
+#include "table.h"
+#include "vm.h"
+
+// Permanent strings are shared by every VM and chunk in the process, so the
+// intern table is too. Compiling and freeing chunks write it under this lock;
+// VMs only look strings up, under its read lock, so they do not wait for
+// each other. Reading a string needs no lock since it never changes.
+//
+// A chunk holds one reference to each string among its constants and names,
+// and a VM one to each permanent string it interned while running, see
+// finishString(). Dropping the last reference frees the string. References
+// are taken under either lock, so they are counted atomically.
+static pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+static Table strings;  // Keys are the interned strings, values are nil.
+
+// 32-bit FNV-1a.
+static uint32_t hashString(const char* chars, int length) {
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < length; i++) {
+    hash ^= (uint8_t)chars[i];
+    hash *= 16777619;
+  }
+  return hash;
+}
+
+// Returns a new reference to the string with the given contents, creating it
+// if it does not exist yet. Call with the lock held for writing.
+static ObjString* internString(const char* chars, int length, uint32_t hash) {
+  ObjString* interned = tableFindString(&strings, chars, length, hash);
+  if (interned != NULL) {
+    __atomic_add_fetch(&interned->references, 1, __ATOMIC_RELAXED);
+    return interned;
+  }
+
+  ObjString* string = (ObjString*)reallocate(
+      NULL, 0, sizeof(ObjString) + (size_t)length + 1);
+  string->obj.type = OBJ_STRING;
+  string->obj.generation = GEN_PERMANENT;
+  string->obj.isMarked = false;
+  string->obj.isRemembered = false;
+  string->obj.next = NULL;
+  string->length = length;
+  string->hash = hash;
+  string->references = 1;
+  memcpy(string->chars, chars, length);
+  string->chars[length] = '\0';
+
+  tableSet(&strings, OBJ_VAL(string), NIL_VAL);
+  return string;
+}
+
+// Returns a permanent string, for constants, with a reference the caller
+// passes on to a chunk or drops with releaseString(). Strings created while
+// running come from allocateString() instead.
+ObjString* copyString(const char* chars, int length) {
+  uint32_t hash = hashString(chars, length);
+
+  pthread_rwlock_wrlock(&lock);
+  ObjString* string = internString(chars, length, hash);
+  pthread_rwlock_unlock(&lock);
+  return string;
+}
+
+// Drops a reference to a permanent string, freeing it with the last one.
+// Lookups hold the read lock while they take a reference, so none can revive
+// the string once the count reaches zero here.
+void releaseString(ObjString* string) {
+  pthread_rwlock_wrlock(&lock);
+  if (__atomic_sub_fetch(&string->references, 1, __ATOMIC_RELAXED) == 0) {
+    tableDelete(&strings, OBJ_VAL(string));
+    reallocate(string, objectSize(&string->obj), 0);
+  }
+  pthread_rwlock_unlock(&lock);
+}
+
+ObjString* concatenateStrings(ObjString* a, ObjString* b) {
+  int length = a->length + b->length;
+  char* chars = ALLOCATE(char, length + 1);
+  memcpy(chars, a->chars, a->length);
+  memcpy(chars + a->length, b->chars, b->length);
+
+  ObjString* result = copyString(chars, length);
+  FREE_ARRAY(char, chars, length + 1);
+  return result;
+}
+
+// Returns a string of length characters on vm's heap for the caller to fill
+// in and pass to finishString(). Like any allocation it may collect, which
+// moves young objects, so re-read pointers to them afterwards.
+ObjString* allocateString(VM* vm, int length) {
+  ObjString* string = (ObjString*)allocateObject(
+      vm, sizeof(ObjString) + (size_t)length + 1, OBJ_STRING);
+  string->length = length;
+  string->chars[length] = '\0';
+  return string;
+}
+
+// Finishes a string from allocateString() once its characters are in, and
+// returns the interned string with its contents: a permanent one if there is
+// one, else the first the VM made. Use the result in place of string.
+//
+// Each VM interns its own strings in a weak table the collector prunes. The
+// table is emptied before every run, since nothing from earlier runs is
+// reachable then, and the constants of the chunk being run are all older
+// than that. So no string the VM interns can duplicate a permanent one it
+// will see, and strings compare by pointer. A permanent string found instead
+// goes into the table too, which holds a reference to it until the next run:
+// it may belong to another chunk, which can be freed in the meantime. The
+// table is kept across the lines of a REPL session, see interpretLine().
+ObjString* finishString(VM* vm, ObjString* string) {
+  string->hash = hashString(string->chars, string->length);
+
+  Heap* heap = &vm->heap;
+  ObjString* interned = tableFindString(&heap->strings, string->chars,
+                                        string->length, string->hash);
+  if (interned != NULL) {
+    // The marker may not have reached it, and nothing it has seen may still
+    // point to it.
+    if (heap->marking && interned->obj.generation == GEN_OLD) {
+      shadeObject(heap, &interned->obj);
+    }
+    return interned;
+  }
+
+  if (vm->lineCount > 0) {
+    // In a REPL session the string may outlive the run in a global, and a
+    // later line may have it among its constants. So it is made permanent.
+    string = copyString(string->chars, string->length);
+  } else {
+    pthread_rwlock_rdlock(&lock);
+    interned = tableFindString(&strings, string->chars, string->length,
+                               string->hash);
+    if (interned != NULL) {
+      __atomic_add_fetch(&interned->references, 1, __ATOMIC_RELAXED);
+    }
+    pthread_rwlock_unlock(&lock);
+    if (interned != NULL) string = interned;
+  }
+
+  tableSet(&heap->strings, OBJ_VAL(string), NIL_VAL);
+  return string;
+}
+
+// Has vm hold a reference to a permanent string until its next run, like
+// the ones finishString() finds. For a result, which has to outlive the
+// chunk it may be a constant of.
+void holdString(VM* vm, ObjString* string) {
+  if (!tableSet(&vm->heap.strings, OBJ_VAL(string), NIL_VAL)) return;
+  // The chunk being run holds a reference too, so the string stays alive.
+  __atomic_add_fetch(&string->references, 1, __ATOMIC_RELAXED);
+}
+
+// Empties a VM's table of interned strings, dropping its references to the
+// permanent ones.
+void clearInternedStrings(Table* table) {
+  for (int i = 0; i < table->capacity; i++) {
+    Value key = table->entries[i].key;
+    if (!IS_EMPTY(key) && AS_OBJ(key)->generation == GEN_PERMANENT) {
+      releaseString(AS_STRING(key));
+    }
+  }
+  tableClear(table);
+}
+
+ObjClass* newClass(VM* vm, ObjString* name) {
+  ObjClass* klass =
+      (ObjClass*)allocateObject(vm, sizeof(ObjClass), OBJ_CLASS);
+  klass->name = name;
+  return klass;
+}
+
+// Returns an instance without fields for the caller to set the class of.
+// Allocating may move the class, so read it again afterwards.
+ObjInstance* newInstance(VM* vm, Shape* shape) {
+  ObjInstance* instance =
+      (ObjInstance*)allocateObject(vm, sizeof(ObjInstance), OBJ_INSTANCE);
+  instance->klass = NULL;
+  instance->shape = shape;
+  instance->fields = NULL;
+  return instance;
+}
+
+// Returns a field array with every slot nil.
+ObjFields* newFields(VM* vm, int capacity) {
+  ObjFields* fields = (ObjFields*)allocateObject(
+      vm, sizeof(ObjFields) + sizeof(Value) * (size_t)capacity, OBJ_FIELDS);
+  fields->capacity = capacity;
+  for (int i = 0; i < capacity; i++) fields->values[i] = NIL_VAL;
+  return fields;
+}
+
+// The bytes object takes up, as allocated.
+size_t objectSize(Obj* object) {
+  switch (object->type) {
+    case OBJ_CLASS:
+      return sizeof(ObjClass);
+    case OBJ_FIELDS:
+      return sizeof(ObjFields) +
+             sizeof(Value) * (size_t)((ObjFields*)object)->capacity;
+    case OBJ_INSTANCE:
+      return sizeof(ObjInstance);
+    case OBJ_STRING:
+      return sizeof(ObjString) + (size_t)((ObjString*)object)->length + 1;
+  }
+  return 0;
+}
+
+void printObject(Value value) {
+  switch (OBJ_TYPE(value)) {
+    case OBJ_CLASS:
+      printf("%s", AS_CLASS(value)->name->chars);
+      break;
+    case OBJ_FIELDS:
+      printf("<fields>");
+      break;
+    case OBJ_INSTANCE:
+      printf("%s instance", AS_INSTANCE(value)->klass->name->chars);
+      break;
+    case OBJ_STRING:
+      printf("%.*s", AS_STRING(value)->length, AS_CSTRING(value));
+      break;
+  }
+}
@@ -0,0 +1,100 @@
+#ifndef BYTE_OBJECT_H
+#define BYTE_OBJECT_H
+
+#include "common.h"
+#include "table.h"
+#include "value.h"
+
+#define OBJ_TYPE(value) (AS_OBJ(value)->type)
+
+#define IS_CLASS(value) isObjType(value, OBJ_CLASS)
+#define IS_INSTANCE(value) isObjType(value, OBJ_INSTANCE)
+#define IS_STRING(value) isObjType(value, OBJ_STRING)
+
+#define AS_CLASS(value) ((ObjClass*)AS_OBJ(value))
+#define AS_INSTANCE(value) ((ObjInstance*)AS_OBJ(value))
+#define AS_STRING(value) ((ObjString*)AS_OBJ(value))
+#define AS_CSTRING(value) (((ObjString*)AS_OBJ(value))->chars)
+
+typedef struct VM VM;
+typedef struct Shape Shape;
+
+typedef enum {
+  OBJ_CLASS,
+  OBJ_FIELDS,
+  OBJ_INSTANCE,
+  OBJ_STRING,
+} ObjType;
+
+typedef enum {
+  GEN_YOUNG,      // In a VM's nursery.
+  GEN_FORWARDED,  // Copied out of the nursery; next points to the copy.
+  GEN_OLD,        // Promoted, or too large for the nursery.
+  GEN_PERMANENT,  // A constant, shared by every VM; see copyString().
+} Generation;
+
+// Header shared by every heap object.
+struct Obj {
+  ObjType type;
+  uint8_t generation;
+  bool isMarked;
+  bool isRemembered;  // Whether the heap's remembered set holds it.
+  // The next object in the same generation, newest first. Young objects are
+  // not linked.
+  struct Obj* next;
+};
+
+// Immutable and interned: two strings with the same contents are the same
+// object, so they compare equal by pointer. Permanent strings are interned
+// process-wide, and each VM interns the ones it creates; see finishString().
+struct ObjString {
+  Obj obj;
+  int length;
+  uint32_t hash;
+  int references;  // Counted only for permanent strings.
+  char chars[];    // NUL-terminated.
+};
+
+typedef struct {
+  Obj obj;
+  // A constant of the chunk that created the class. Only read while that
+  // chunk runs, since the chunk may be freed before the class is collected.
+  ObjString* name;
+} ObjClass;
+
+// The field array of an instance, one slot per field of its shape, with the
+// unused ones nil. Only ever referenced by its instance, which replaces it
+// with a bigger copy when it runs out of room.
+typedef struct {
+  Obj obj;
+  int capacity;
+  Value values[];
+} ObjFields;
+
+// The shape says which slot of fields each field is in. fields is NULL until
+// the instance gets its first one.
+typedef struct {
+  Obj obj;
+  ObjClass* klass;
+  Shape* shape;
+  ObjFields* fields;
+} ObjInstance;
+
+ObjString* copyString(const char* chars, int length);
+void releaseString(ObjString* string);
+ObjString* concatenateStrings(ObjString* a, ObjString* b);
+ObjString* allocateString(VM* vm, int length);
+ObjString* finishString(VM* vm, ObjString* string);
+void holdString(VM* vm, ObjString* string);
+void clearInternedStrings(Table* table);
+ObjClass* newClass(VM* vm, ObjString* name);
+ObjInstance* newInstance(VM* vm, Shape* shape);
+ObjFields* newFields(VM* vm, int capacity);
+size_t objectSize(Obj* object);
+void printObject(Value value);
+
+static inline bool isObjType(Value value, ObjType type) {
+  return IS_OBJ(value) && AS_OBJ(value)->type == type;
+}
+
+#endif
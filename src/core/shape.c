@@ -0,0 +1,51 @@
+#include "shape.h"
+
+#include "memory.h"
+
+static Shape* newShape(Shape* parent, ObjString* name) {
+  Shape* shape = ALLOCATE(Shape, 1);
+  shape->parent = parent;
+  shape->name = name;
+  shape->fieldCount = parent == NULL ? 0 : parent->fieldCount + 1;
+  shape->children = NULL;
+  shape->sibling = NULL;
+  return shape;
+}
+
+// Returns the root of a new tree, the shape of an instance without fields.
+Shape* newShapeTree() { return newShape(NULL, NULL); }
+
+void freeShapeTree(Shape* root) {
+  Shape* shape = root;
+  while (shape != NULL) {
+    Shape* sibling = shape->sibling;
+    freeShapeTree(shape->children);
+    FREE(Shape, shape);
+    shape = sibling;
+  }
+}
+
+// The slot of the field called name in instances of shape, or -1 if they
+// have no such field. Walks one parent per field, so it is only for the
+// accesses their inline cache misses.
+int shapeSlot(Shape* shape, ObjString* name) {
+  for (; shape->parent != NULL; shape = shape->parent) {
+    if (shape->name == name) return shape->fieldCount - 1;
+  }
+  return -1;
+}
+
+// The shape an instance of shape moves to when it gets a field called name,
+// which it must not have yet. Created the first time it is needed, so every
+// instance given the same fields in the same order ends up sharing it.
+Shape* shapeWithField(Shape* shape, ObjString* name) {
+  for (Shape* child = shape->children; child != NULL;
+       child = child->sibling) {
+    if (child->name == name) return child;
+  }
+
+  Shape* child = newShape(shape, name);
+  child->sibling = shape->children;
+  shape->children = child;
+  return child;
+}
@@ -0,0 +1,33 @@
+#ifndef BYTE_SHAPE_H
+#define BYTE_SHAPE_H
+
+#include "common.h"
+#include "object.h"
+
+// The layout of an instance: which fields it has, and the slot of its field
+// array each one lives in. Instances that were given the same fields in the
+// same order share a shape, so a property access that has seen the shape
+// before knows the slot without looking the name up; see PropertyCache.
+//
+// Shapes form a tree. The root has no fields, and every other shape has the
+// fields of its parent plus one more, in the next slot. Field names are
+// permanent strings, so they compare by pointer. They are never read, so a
+// shape may outlive the chunks its name came from: while a chunk runs, no
+// other live string can have the address of a freed one. Each VM owns its
+// own tree, which grows as instances get new fields and lives as long as the
+// VM.
+typedef struct Shape {
+  struct Shape* parent;
+  ObjString* name;  // Of the field this shape adds, NULL at the root.
+  int fieldCount;
+  // The shapes adding one field to this one, linked through sibling.
+  struct Shape* children;
+  struct Shape* sibling;
+} Shape;
+
+Shape* newShapeTree();
+void freeShapeTree(Shape* root);
+int shapeSlot(Shape* shape, ObjString* name);
+Shape* shapeWithField(Shape* shape, ObjString* name);
+
+#endif
@@ -0,0 +1,198 @@
+#include "table.h"
+
+#include <string.h>
+
+#include "memory.h"
+#include "object.h"
+
+#define TABLE_MAX_LOAD 0.75
+
+void initTable(Table* table) {
+  table->count = 0;
+  table->capacity = 0;
+  table->entries = NULL;
+}
+
+void freeTable(Table* table) {
+  FREE_ARRAY(Entry, table->entries, table->capacity);
+  initTable(table);
+}
+
+// Empties table but keeps its entries for reuse.
+void tableClear(Table* table) {
+  for (int i = 0; i < table->capacity; i++) {
+    table->entries[i].key = EMPTY_VAL;
+    table->entries[i].value = NIL_VAL;
+  }
+  table->count = 0;
+}
+
+static bool keysIdentical(Value a, Value b) {
+#ifdef BYTE_NAN_BOXING
+  return a == b;
+#else
+  if (a.type != b.type) return false;
+  switch (a.type) {
+    case VAL_BOOL:
+      return AS_BOOL(a) == AS_BOOL(b);
+    case VAL_NUMBER:
+      return memcmp(&a.as.number, &b.as.number, sizeof(double)) == 0;
+    case VAL_OBJ:
+      return AS_OBJ(a) == AS_OBJ(b);
+    default:
+      return true;
+  }
+#endif
+}
+
+static uint32_t hashValue(Value value) {
+  // By content, so findString() can look a string up before it exists.
+  if (IS_STRING(value)) return AS_STRING(value)->hash;
+
+  uint64_t bits;
+#ifdef BYTE_NAN_BOXING
+  bits = value;
+#else
+  switch (value.type) {
+    case VAL_BOOL:
+      bits = AS_BOOL(value) ? 3 : 2;
+      break;
+    case VAL_NUMBER:
+      memcpy(&bits, &value.as.number, sizeof(double));
+      break;
+    case VAL_OBJ:
+      bits = (uint64_t)(uintptr_t)AS_OBJ(value);
+      break;
+    default:
+      bits = 1;
+      break;
+  }
+#endif
+
+  // Mix the high bits down, doubles differ mostly in the exponent and the top
+  // of the mantissa.
+  bits ^= bits >> 33;
+  bits *= 0xff51afd7ed558ccdULL;
+  bits ^= bits >> 33;
+  return (uint32_t)bits;
+}
+
+static Entry* findEntry(Entry* entries, int capacity, Value key) {
+  uint32_t index = hashValue(key) & (capacity - 1);
+  Entry* tombstone = NULL;
+
+  for (;;) {
+    Entry* entry = &entries[index];
+    if (IS_EMPTY(entry->key)) {
+      if (IS_NIL(entry->value)) {
+        // Reuse a tombstone passed on the way, if any.
+        return tombstone != NULL ? tombstone : entry;
+      }
+      if (tombstone == NULL) tombstone = entry;
+    } else if (keysIdentical(entry->key, key)) {
+      return entry;
+    }
+
+    index = (index + 1) & (capacity - 1);
+  }
+}
+
+static void adjustCapacity(Table* table, int capacity) {
+  Entry* entries = ALLOCATE(Entry, capacity);
+  for (int i = 0; i < capacity; i++) {
+    entries[i].key = EMPTY_VAL;
+    entries[i].value = NIL_VAL;
+  }
+
+  // Tombstones are not carried over, so recount.
+  table->count = 0;
+  for (int i = 0; i < table->capacity; i++) {
+    Entry* entry = &table->entries[i];
+    if (IS_EMPTY(entry->key)) continue;
+
+    Entry* dest = findEntry(entries, capacity, entry->key);
+    dest->key = entry->key;
+    dest->value = entry->value;
+    table->count++;
+  }
+
+  FREE_ARRAY(Entry, table->entries, table->capacity);
+  table->entries = entries;
+  table->capacity = capacity;
+}
+
+bool tableGet(Table* table, Value key, Value* value) {
+  if (table->count == 0) return false;
+
+  Entry* entry = findEntry(table->entries, table->capacity, key);
+  if (IS_EMPTY(entry->key)) return false;
+
+  *value = entry->value;
+  return true;
+}
+
+// Returns true if the key was not in the table before.
+bool tableSet(Table* table, Value key, Value value) {
+  if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
+    int capacity = GROW_CAPACITY(table->capacity);
+    adjustCapacity(table, capacity);
+  }
+
+  Entry* entry = findEntry(table->entries, table->capacity, key);
+  bool isNewKey = IS_EMPTY(entry->key);
+  // Tombstones are already counted.
+  if (isNewKey && IS_NIL(entry->value)) table->count++;
+
+  entry->key = key;
+  entry->value = value;
+  return isNewKey;
+}
+
+// Looks up an interned string by its contents, where keys are strings.
+ObjString* tableFindString(Table* table, const char* chars, int length,
+                           uint32_t hash) {
+  if (table->count == 0) return NULL;
+
+  uint32_t index = hash & (table->capacity - 1);
+  for (;;) {
+    Entry* entry = &table->entries[index];
+    if (IS_EMPTY(entry->key)) {
+      // Stop at an empty bucket, skip over tombstones.
+      if (IS_NIL(entry->value)) return NULL;
+    } else {
+      ObjString* string = AS_STRING(entry->key);
+      if (string->length == length && string->hash == hash &&
+          memcmp(string->chars, chars, length) == 0) {
+        return string;
+      }
+    }
+
+    index = (index + 1) & (table->capacity - 1);
+  }
+}
+
+bool tableDelete(Table* table, Value key) {
+  if (table->count == 0) return false;
+
+  Entry* entry = findEntry(table->entries, table->capacity, key);
+  if (IS_EMPTY(entry->key)) return false;
+
+  // Leave a tombstone so later keys in the probe sequence stay reachable.
+  entry->key = EMPTY_VAL;
+  entry->value = BOOL_VAL(true);
+  return true;
+}
+
+// Replaces every key with relocate(context, key), deleting the entry when that
+// is EMPTY_VAL. For the collector, which moves and frees strings; the new key
+// must hash like the old one.
+void tableRelocateKeys(Table* table, Value (*relocate)(void*, Value),
+                       void* context) {
+  for (int i = 0; i < table->capacity; i++) {
+    Entry* entry = &table->entries[i];
+    if (IS_EMPTY(entry->key)) continue;
+
+    entry->key = relocate(context, entry->key);
+    if (IS_EMPTY(entry->key)) entry->value = BOOL_VAL(true);
+  }
+}
@@ -0,0 +1,34 @@
+#ifndef BYTE_TABLE_H
+#define BYTE_TABLE_H
+
+#include "common.h"
+#include "value.h"
+
+// An empty bucket has an EMPTY_VAL key and a nil value. A deleted one keeps
+// the EMPTY_VAL key but has a true value so probing continues past it.
+typedef struct {
+  Value key;
+  Value value;
+} Entry;
+
+// Open-addressing hash table keyed by Value. Keys match only when they are
+// the same value bit for bit, so 0 and -0 are distinct keys and a NaN can be
+// found again.
+typedef struct {
+  int count;
+  int capacity;
+  Entry* entries;
+} Table;
+
+void initTable(Table* table);
+void freeTable(Table* table);
+void tableClear(Table* table);
+bool tableGet(Table* table, Value key, Value* value);
+bool tableSet(Table* table, Value key, Value value);
+bool tableDelete(Table* table, Value key);
+ObjString* tableFindString(Table* table, const char* chars, int length,
+                           uint32_t hash);
+void tableRelocateKeys(Table* table, Value (*relocate)(void*, Value),
+                       void* context);
+
+#endif
@@ -3,6 +3,7 @@
 #include <stdio.h>
 
 #include "memory.h"
+#include "object.h"
 
 void initValueArray(ValueArray* array) {
   array->values = NULL;
@@ -28,6 +29,17 @@ void freeValueArray(ValueArray* array) {
 }
 
 void printValue(Value value) {
+#ifdef BYTE_NAN_BOXING
+  if (IS_BOOL(value)) {
+    printf(AS_BOOL(value) ? "true" : "false");
+  } else if (IS_NIL(value)) {
+    printf("nil");
+  } else if (IS_NUMBER(value)) {
+    printf("%g", AS_NUMBER(value));
+  } else if (IS_OBJ(value)) {
+    printObject(value);
+  }
+#else
   switch (value.type) {
     case VAL_BOOL:
       printf(AS_BOOL(value) ? "true" : "false");
@@ -38,11 +50,32 @@ void printValue(Value value) {
     case VAL_NUMBER:
       printf("%g", AS_NUMBER(value));
       break;
+    case VAL_OBJ:
+      printObject(value);
+      break;
+    case VAL_EMPTY:
+      printf("<empty>");
+      break;
   }
+#endif
+}
+
+// nil and false are falsey and every other value behaves like true
+bool isFalsy(Value value) {
+  return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
 // check type and underlying values
 bool valuesEqual(Value a, Value b) {
+#ifdef BYTE_NAN_BOXING
+  // Compare numbers as doubles so NaN != NaN and 0 == -0, like the tagged
+  // representation does. Every other value is equal only to its own bits;
+  // strings are interned.
+  if (IS_NUMBER(a) && IS_NUMBER(b)) {
+    return AS_NUMBER(a) == AS_NUMBER(b);
+  }
+  return a == b;
+#else
   if (a.type != b.type) return false;
   switch (a.type) {
     case VAL_BOOL:
@@ -51,7 +84,10 @@ bool valuesEqual(Value a, Value b) {
       return true;
     case VAL_NUMBER:
       return AS_NUMBER(a) == AS_NUMBER(b);
+    case VAL_OBJ:
+      return AS_OBJ(a) == AS_OBJ(b);
     default:
       return false;
   }
+#endif
 }
@@ -2,19 +2,86 @@
 #define BYTE_VALUE_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "common.h"
+
+typedef struct Obj Obj;
+typedef struct ObjString ObjString;
+
+#ifdef BYTE_NAN_BOXING
+
+// Every Value is a single 64-bit word. Numbers are stored as plain IEEE 754
+// doubles; everything else lives inside the payload of a quiet NaN that the
+// FPU never produces on its own:
+//
+//   [sign:1][exponent:11 all set][quiet:1][intel:1][payload:50]
+//
+// The low bits of the payload carry the singleton tags below, and the sign
+// bit is reserved for object pointers, which fit in the remaining 48 bits.
+typedef uint64_t Value;
+
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NIL 1    // 01.
+#define TAG_FALSE 2  // 10.
+#define TAG_TRUE 3   // 11.
+#define TAG_EMPTY 4  // 100. Unused table slots and undefined globals.
+
+// Typecheck before converting to C Value
+#define IS_BOOL(value) (((value) | 1) == TRUE_VAL)
+#define IS_NIL(value) ((value) == NIL_VAL)
+#define IS_NUMBER(value) (((value) & QNAN) != QNAN)
+#define IS_EMPTY(value) ((value) == EMPTY_VAL)
+#define IS_OBJ(value) (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+
+// Byte to C Value
+#define AS_BOOL(value) ((value) == TRUE_VAL)
+#define AS_NUMBER(value) valueToNum(value)
+#define AS_OBJ(value) ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+// C to Byte Value
+#define BOOL_VAL(b) ((b) ? TRUE_VAL : FALSE_VAL)
+#define FALSE_VAL ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL ((Value)(uint64_t)(QNAN | TAG_TRUE))
+#define NIL_VAL ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define EMPTY_VAL ((Value)(uint64_t)(QNAN | TAG_EMPTY))
+#define NUMBER_VAL(num) numToValue(num)
+#define OBJ_VAL(obj) (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
+
+// memcpy is the well-defined way to type-pun; compilers lower it to a move.
+static inline double valueToNum(Value value) {
+  double num;
+  memcpy(&num, &value, sizeof(Value));
+  return num;
+}
+
+static inline Value numToValue(double num) {
+  Value value;
+  memcpy(&value, &num, sizeof(double));
+  return value;
+}
+
+#else
 
 typedef enum {
   VAL_BOOL,
   VAL_NIL,
   VAL_NUMBER,
+  VAL_OBJ,
+  VAL_EMPTY,  // Never visible to scripts, marks unused table slots and
+              // undefined globals.
 } ValueType;
 
-// [type:4][pad:4][as:8] where as[0]=bool, as[0..7]=number
+// [type:4][pad:4][as:8] where as[0]=bool, as[0..7]=number or object pointer
 typedef struct {
   ValueType type;
   union {
     bool boolean;
     double number;
+    Obj* obj;
   } as;
 } Value;
 
@@ -22,15 +89,22 @@ typedef struct {
 #define IS_BOOL(value) ((value).type == VAL_BOOL)
 #define IS_NIL(value) ((value).type == VAL_NIL)
 #define IS_NUMBER(value) ((value).type == VAL_NUMBER)
+#define IS_EMPTY(value) ((value).type == VAL_EMPTY)
+#define IS_OBJ(value) ((value).type == VAL_OBJ)
 
 // Byte to C Value
 #define AS_BOOL(value) ((value).as.boolean)
 #define AS_NUMBER(value) ((value).as.number)
+#define AS_OBJ(value) ((value).as.obj)
 
 // C to Byte Value
 #define BOOL_VAL(value) ((Value){VAL_BOOL, {.boolean = value}})
 #define NIL_VAL ((Value){VAL_NIL, {.number = 0}})
+#define EMPTY_VAL ((Value){VAL_EMPTY, {.number = 0}})
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
+#define OBJ_VAL(object) ((Value){VAL_OBJ, {.obj = (Obj*)object}})
+
+#endif
 
 typedef struct {
   int capacity;
@@ -38,6 +112,7 @@ typedef struct {
   Value* values;
 } ValueArray;
 
+bool isFalsy(Value value);
 bool valuesEqual(Value a, Value b);
 void initValueArray(ValueArray* array);
 void writeValueArray(ValueArray* array, Value value);
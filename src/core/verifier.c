@@ -0,0 +1,195 @@
+#include "verifier.h"
+
+#include <stdio.h>
+
+#include "memory.h"
+#include "object.h"
+
+static bool invalid(int offset, const char* message) {
+  fprintf(stderr, "Invalid bytecode at %04d: %s\n", offset, message);
+  return false;
+}
+
+// Checks the operand of the instruction at offset. The code is known to hold
+// all of its operand bytes.
+static bool verifyOperand(Chunk* chunk, int inputCount, int offset) {
+  uint8_t* operand = &chunk->code[offset + 1];
+
+  switch (unquickened(chunk->code[offset])) {
+    case OP_CONSTANT:
+      if (operand[0] >= chunk->constants.count) {
+        return invalid(offset, "Constant index out of range.");
+      }
+      return true;
+    case OP_CONSTANT_LONG: {
+      int index = (operand[0] << 16) | (operand[1] << 8) | operand[2];
+      if (index >= chunk->constants.count) {
+        return invalid(offset, "Constant index out of range.");
+      }
+      return true;
+    }
+    case OP_ADD_CONST:
+    case OP_SUBTRACT_CONST:
+    case OP_MULTIPLY_CONST:
+    case OP_DIVIDE_CONST:
+      if (operand[0] >= chunk->constants.count) {
+        return invalid(offset, "Constant index out of range.");
+      }
+      // The handlers read the constant as a number without looking.
+      if (!IS_NUMBER(chunk->constants.values[operand[0]])) {
+        return invalid(offset, "Operand is not a number constant.");
+      }
+      return true;
+    case OP_GET_INPUT:
+      if (operand[0] >= inputCount) {
+        return invalid(offset, "Input index out of range.");
+      }
+      return true;
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL:
+      if (operand[0] >= chunk->globals.count) {
+        return invalid(offset, "Global index out of range.");
+      }
+      return true;
+    case OP_CLASS: {
+      int index = (operand[0] << 8) | operand[1];
+      if (index >= chunk->constants.count) {
+        return invalid(offset, "Constant index out of range.");
+      }
+      // The class keeps the name without looking at it.
+      if (!IS_STRING(chunk->constants.values[index])) {
+        return invalid(offset, "Class name is not a string constant.");
+      }
+      return true;
+    }
+    case OP_GET_PROPERTY:
+    case OP_SET_PROPERTY:
+      if (((operand[0] << 8) | operand[1]) >= chunk->properties.count) {
+        return invalid(offset, "Property index out of range.");
+      }
+      return true;
+    default:
+      return true;
+  }
+}
+
+// What the verifier knows about each byte of code: the stack depth an
+// instruction runs at, once a path to it has been followed.
+#define UNREACHED -1
+#define NOT_INSTRUCTION -2
+
+// Checks each instruction on its own, in order, and marks where they start.
+static bool decode(Chunk* chunk, int inputCount, int* depths) {
+  for (int offset = 0; offset < chunk->count;) {
+    uint8_t instruction = chunk->code[offset];
+    if (instruction >= opCount) {
+      return invalid(offset, "Unknown opcode.");
+    }
+
+    const OpInfo* info = &opInfo[instruction];
+    if (offset + 1 + info->operandBytes > chunk->count) {
+      return invalid(offset, "Truncated instruction.");
+    }
+    if (!verifyOperand(chunk, inputCount, offset)) return false;
+
+    depths[offset] = UNREACHED;
+    for (int i = 1; i <= info->operandBytes; i++) {
+      depths[offset + i] = NOT_INSTRUCTION;
+    }
+    offset += 1 + info->operandBytes;
+  }
+
+  for (int offset = 0; offset < chunk->count;) {
+    if (isJump(chunk->code[offset])) {
+      int target = jumpTarget(chunk, offset);
+      if (target < 0 || target >= chunk->count ||
+          depths[target] != UNREACHED) {
+        return invalid(offset, "Jump target is not an instruction.");
+      }
+    }
+    offset += 1 + opInfo[chunk->code[offset]].operandBytes;
+  }
+  return true;
+}
+
+// Records that the instruction at offset can run at depth, and queues it if
+// that is news. Every path must reach it at the same depth.
+static bool reach(Chunk* chunk, int* depths, int* worklist, int* count,
+                  int offset, int depth) {
+  if (offset >= chunk->count) return invalid(offset, "Missing return.");
+  if (depths[offset] == UNREACHED) {
+    depths[offset] = depth;
+    worklist[(*count)++] = offset;
+    return true;
+  }
+  if (depths[offset] != depth) {
+    return invalid(offset, "Stack depth differs between paths.");
+  }
+  return true;
+}
+
+// Follows every path through the chunk from its start, giving each
+// instruction the only stack depth it can run at.
+static bool trace(Chunk* chunk, int* depths, int* worklist) {
+  int count = 0;
+  int maxStack = 0;
+  if (!reach(chunk, depths, worklist, &count, 0, 0)) return false;
+
+  while (count > 0) {
+    int offset = worklist[--count];
+    uint8_t instruction = chunk->code[offset];
+    const OpInfo* info = &opInfo[instruction];
+    int depth = depths[offset];
+
+    int pops = info->pops;
+    if (instruction == OP_POPN) pops = chunk->code[offset + 1];
+    if (instruction == OP_CALL) pops += chunk->code[offset + 1];
+    if (depth < pops) {
+      return invalid(offset, "Stack underflow.");
+    }
+    // A local must be below the operands of the instruction using it.
+    if ((instruction == OP_GET_LOCAL || instruction == OP_SET_LOCAL) &&
+        chunk->code[offset + 1] >= depth - pops) {
+      return invalid(offset, "Local slot out of range.");
+    }
+    depth += info->pushes - pops;
+    if (depth > maxStack) maxStack = depth;
+
+    if (instruction == OP_RETURN) {
+      // The returned value must be the only one on the stack.
+      if (depth != 0) return invalid(offset, "Return with values left over.");
+      continue;
+    }
+
+    // Both jumps are conditional, so every instruction may fall through.
+    if (isJump(instruction) &&
+        !reach(chunk, depths, worklist, &count, jumpTarget(chunk, offset),
+               depth)) {
+      return false;
+    }
+    if (!reach(chunk, depths, worklist, &count,
+               offset + 1 + info->operandBytes, depth)) {
+      return false;
+    }
+  }
+
+  for (int offset = 0; offset < chunk->count; offset++) {
+    if (depths[offset] == UNREACHED) {
+      return invalid(offset, "Unreachable code.");
+    }
+  }
+  chunk->maxStack = maxStack;
+  return true;
+}
+
+bool verifyChunk(Chunk* chunk, int inputCount) {
+  if (chunk->count == 0) return invalid(0, "Missing return.");
+
+  int* depths = ALLOCATE(int, chunk->count);
+  int* worklist = ALLOCATE(int, chunk->count);
+  bool ok = decode(chunk, inputCount, depths) &&
+            trace(chunk, depths, worklist);
+  FREE_ARRAY(int, depths, chunk->count);
+  FREE_ARRAY(int, worklist, chunk->count);
+  return ok;
+}
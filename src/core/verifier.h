@@ -0,0 +1,16 @@
+#ifndef BYTE_VERIFIER_H
+#define BYTE_VERIFIER_H
+
+#include "chunk.h"
+#include "common.h"
+
+// Checks that chunk is safe to run without any checks in the VM: every
+// instruction is known and complete, operands naming constants, inputs,
+// globals and properties are in range, jumps land on instructions, every
+// path reaches each instruction at the same stack depth, which never
+// underflows, and the chunk returns exactly one value.
+// On success records the deepest stack in chunk->maxStack. Otherwise reports
+// the first problem on stderr and returns false.
+bool verifyChunk(Chunk* chunk, int inputCount);
+
+#endif
@@ -0,0 +1,312 @@
+#include "counters.h"
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const char* counterNames[] = {
+    [COUNTER_CYCLES] = "cycles",
+    [COUNTER_INSTRUCTIONS] = "instructions",
+    [COUNTER_BRANCH_MISSES] = "branch-misses",
+    [COUNTER_L1D_MISSES] = "L1d-misses",
+};
+
+static const char* phaseNames[] = {
+    [PHASE_SCAN] = "scan",
+    [PHASE_COMPILE] = "compile",
+    [PHASE_RUN] = "run",
+};
+
+static const char* classNames[] = {
+    [CLASS_LOAD] = "load",
+    [CLASS_VARIABLE] = "variable",
+    [CLASS_ARITHMETIC] = "arithmetic",
+    [CLASS_COMPARISON] = "comparison",
+    [CLASS_LOGIC] = "logic",
+    [CLASS_LOOP] = "loop",
+    [CLASS_OBJECT] = "object",
+    [CLASS_RETURN] = "return",
+};
+
+static OpcodeClass opcodeClass(uint8_t instruction) {
+  switch (unquickened(instruction)) {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_GET_INPUT:
+      return CLASS_LOAD;
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_POP:
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_POPN:
+      return CLASS_VARIABLE;
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_NOT_EQUAL:
+    case OP_GREATER_EQUAL:
+    case OP_LESS_EQUAL:
+      return CLASS_COMPARISON;
+    case OP_NOT:
+      return CLASS_LOGIC;
+    case OP_FOR_RANGE:
+    case OP_FOR_LOOP:
+      return CLASS_LOOP;
+    case OP_CLASS:
+    case OP_CALL:
+    case OP_GET_PROPERTY:
+    case OP_SET_PROPERTY:
+      return CLASS_OBJECT;
+    case OP_RETURN:
+      return CLASS_RETURN;
+    default:
+      return CLASS_ARITHMETIC;
+  }
+}
+
+#ifdef __linux__
+
+static int openEvent(CounterKind kind, int groupFd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  switch (kind) {
+    case COUNTER_CYCLES:
+      attr.config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case COUNTER_INSTRUCTIONS:
+      attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case COUNTER_BRANCH_MISSES:
+      attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+      break;
+    default:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = PERF_COUNT_HW_CACHE_L1D |
+                    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      break;
+  }
+
+  // The whole group is switched on at once through the leader.
+  if (groupFd == -1) {
+    attr.disabled = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+  }
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+void initCounters(Counters* counters, bool byOpcode) {
+  memset(counters, 0, sizeof(Counters));
+  counters->byOpcode = byOpcode;
+  for (int i = 0; i < COUNTER_COUNT; i++) {
+    counters->fds[i] = -1;
+    counters->slots[i] = -1;
+  }
+
+  // Cycles lead the group. Without them nothing else is worth reading.
+  counters->groupFd = openEvent(COUNTER_CYCLES, -1);
+  counters->fds[COUNTER_CYCLES] = counters->groupFd;
+  if (counters->groupFd < 0) {
+    const char* reason = strerror(errno);
+    if (errno == EACCES || errno == EPERM) {
+      reason = "not permitted, see /proc/sys/kernel/perf_event_paranoid";
+    } else if (errno == ENOENT || errno == EOPNOTSUPP) {
+      reason = "no hardware events on this machine";
+    }
+    snprintf(counters->unavailable, sizeof(counters->unavailable), "%s",
+             reason);
+    return;
+  }
+  counters->slots[COUNTER_CYCLES] = counters->opened++;
+
+  // Some PMUs lack an event; report the rest anyway.
+  for (int kind = COUNTER_INSTRUCTIONS; kind < COUNTER_COUNT; kind++) {
+    counters->fds[kind] = openEvent((CounterKind)kind, counters->groupFd);
+    if (counters->fds[kind] >= 0) counters->slots[kind] = counters->opened++;
+  }
+
+  ioctl(counters->groupFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void freeCounters(Counters* counters) {
+  for (int i = 0; i < COUNTER_COUNT; i++) {
+    if (counters->fds[i] >= 0) close(counters->fds[i]);
+    counters->fds[i] = -1;
+  }
+  counters->groupFd = -1;
+}
+
+// Reads every counter into values. Unopened counters read as zero.
+static void readCounters(Counters* counters, uint64_t* values) {
+  uint64_t buffer[3 + COUNTER_COUNT];
+  ssize_t size = (ssize_t)sizeof(uint64_t) * (3 + counters->opened);
+  if (read(counters->groupFd, buffer, size) != size) {
+    memset(buffer, 0, sizeof(buffer));
+  }
+
+  // buffer[1] and buffer[2] are the times enabled and running. They differ
+  // when the kernel had to share the PMU with other groups.
+  if (buffer[1] != buffer[2]) counters->multiplexed = true;
+  for (int i = 0; i < COUNTER_COUNT; i++) {
+    values[i] = counters->slots[i] < 0 ? 0 : buffer[3 + counters->slots[i]];
+  }
+}
+
+#else
+
+void initCounters(Counters* counters, bool byOpcode) {
+  memset(counters, 0, sizeof(Counters));
+  counters->byOpcode = byOpcode;
+  counters->groupFd = -1;
+  for (int i = 0; i < COUNTER_COUNT; i++) {
+    counters->fds[i] = -1;
+    counters->slots[i] = -1;
+  }
+  snprintf(counters->unavailable, sizeof(counters->unavailable),
+           "perf_event_open is Linux only");
+}
+
+void freeCounters(Counters* counters) { counters->groupFd = -1; }
+
+static void readCounters(Counters* counters, uint64_t* values) {
+  (void)counters;
+  memset(values, 0, sizeof(uint64_t) * COUNTER_COUNT);
+}
+
+#endif
+
+static void accumulate(CounterTotals* totals, uint64_t* start,
+                       uint64_t* end) {
+  totals->count++;
+  for (int i = 0; i < COUNTER_COUNT; i++) {
+    totals->values[i] += end[i] - start[i];
+  }
+}
+
+// Phases do not nest, so one start snapshot is enough.
+void beginPhase(Counters* counters) {
+  if (counters->groupFd < 0) return;
+  readCounters(counters, counters->phaseStart);
+}
+
+void endPhase(Counters* counters, Phase phase) {
+  if (counters->groupFd < 0) return;
+  uint64_t now[COUNTER_COUNT];
+  readCounters(counters, now);
+  accumulate(&counters->phases[phase], counters->phaseStart, now);
+}
+
+// Like profileInstruction(), each instruction is charged everything from its
+// dispatch to the next one. Every read is a system call, so the totals are
+// only meaningful relative to each other.
+void countInstruction(Counters* counters, uint8_t instruction) {
+  if (counters->groupFd < 0) return;
+  uint64_t now[COUNTER_COUNT];
+  readCounters(counters, now);
+  if (counters->pending) {
+    accumulate(&counters->classes[counters->pendingClass],
+               counters->pendingStart, now);
+  }
+
+  counters->pending = true;
+  counters->pendingClass = opcodeClass(instruction);
+  // Start after the bookkeeping so it isn't charged to the instruction.
+  readCounters(counters, counters->pendingStart);
+}
+
+void endInstructionCounts(Counters* counters) {
+  if (counters->groupFd < 0 || !counters->pending) return;
+  uint64_t now[COUNTER_COUNT];
+  readCounters(counters, now);
+  accumulate(&counters->classes[counters->pendingClass],
+             counters->pendingStart, now);
+  counters->pending = false;
+}
+
+static void printCount(FILE* out, Counters* counters, CounterKind kind,
+                       uint64_t value) {
+  if (counters->slots[kind] < 0) {
+    fprintf(out, " %14s", "-");
+  } else {
+    fprintf(out, " %14llu", (unsigned long long)value);
+  }
+}
+
+// Prints the events of one row, then IPC and the misses per thousand
+// instructions.
+static void printRow(FILE* out, Counters* counters, const char* label,
+                     CounterTotals* totals) {
+  fprintf(out, "%-12s %12llu", label, (unsigned long long)totals->count);
+  for (int i = 0; i < COUNTER_COUNT; i++) {
+    printCount(out, counters, (CounterKind)i, totals->values[i]);
+  }
+
+  double cycles = (double)totals->values[COUNTER_CYCLES];
+  double instructions = (double)totals->values[COUNTER_INSTRUCTIONS];
+  if (counters->slots[COUNTER_INSTRUCTIONS] < 0 || instructions == 0) {
+    fprintf(out, "\n");
+    return;
+  }
+
+  fprintf(out, " %6.2f", cycles == 0 ? 0 : instructions / cycles);
+  for (int i = COUNTER_BRANCH_MISSES; i <= COUNTER_L1D_MISSES; i++) {
+    if (counters->slots[i] < 0) {
+      fprintf(out, " %8s", "-");
+    } else {
+      fprintf(out, " %8.2f",
+              1000.0 * (double)totals->values[i] / instructions);
+    }
+  }
+  fprintf(out, "\n");
+}
+
+static void printHeader(FILE* out, const char* label, const char* count) {
+  fprintf(out, "%-12s %12s", label, count);
+  for (int i = 0; i < COUNTER_COUNT; i++) {
+    fprintf(out, " %14s", counterNames[i]);
+  }
+  fprintf(out, " %6s %8s %8s\n", "IPC", "br-MPKI", "L1d-MPKI");
+}
+
+void printCounters(Counters* counters, FILE* out) {
+  fprintf(out, "== hardware counters ==\n");
+  if (counters->groupFd < 0) {
+    fprintf(out, "unavailable: %s\n", counters->unavailable);
+    return;
+  }
+
+  printHeader(out, "phase", "count");
+  for (int i = 0; i < PHASE_COUNT; i++) {
+    if (counters->phases[i].count == 0) continue;
+    printRow(out, counters, phaseNames[i], &counters->phases[i]);
+  }
+
+  if (counters->byOpcode) {
+    fprintf(out, "== hardware counters by opcode class ==\n");
+    printHeader(out, "class", "executed");
+    for (int i = 0; i < CLASS_COUNT; i++) {
+      if (counters->classes[i].count == 0) continue;
+      printRow(out, counters, classNames[i], &counters->classes[i]);
+    }
+  }
+
+  if (counters->multiplexed) {
+    fprintf(out, "note: the PMU was shared, counts are incomplete\n");
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef BYTE_COUNTERS_H
+#define BYTE_COUNTERS_H
+
+#include <stdio.h>
+
+#include "core/chunk.h"
+#include "core/common.h"
+
+// Hardware events read through perf_event_open(2), user space only.
+typedef enum {
+  COUNTER_CYCLES,
+  COUNTER_INSTRUCTIONS,
+  COUNTER_BRANCH_MISSES,
+  COUNTER_L1D_MISSES,  // Read misses.
+  COUNTER_COUNT
+} CounterKind;
+
+typedef enum { PHASE_SCAN, PHASE_COMPILE, PHASE_RUN, PHASE_COUNT } Phase;
+
+typedef enum {
+  CLASS_LOAD,        // Constants, literals and inputs.
+  CLASS_VARIABLE,    // Variable reads and writes, and pops.
+  CLASS_ARITHMETIC,  // Including negation and the fused and quickened forms.
+  CLASS_COMPARISON,  // Including equality.
+  CLASS_LOGIC,       // !
+  CLASS_LOOP,        // The counting and jumping of range loops.
+  CLASS_OBJECT,      // Creating classes and instances, and property access.
+  CLASS_RETURN,
+  CLASS_COUNT
+} OpcodeClass;
+
+typedef struct {
+  uint64_t count;  // Phases measured or instructions executed.
+  uint64_t values[COUNTER_COUNT];
+} CounterTotals;
+
+// One group of counters on the calling thread. When the events cannot be
+// opened, because the kernel forbids it or there is no PMU, every call is a
+// no-op and the report says why.
+typedef struct {
+  int fds[COUNTER_COUNT];
+  int groupFd;  // The cycles counter leading the group, -1 when unavailable.
+  // Position of each event in a group read, or -1 if it could not be opened.
+  int slots[COUNTER_COUNT];
+  int opened;
+  bool byOpcode;  // Whether run() should charge each instruction.
+  bool multiplexed;
+  char unavailable[128];  // Why, when groupFd is -1.
+
+  CounterTotals phases[PHASE_COUNT];
+  CounterTotals classes[CLASS_COUNT];
+
+  uint64_t phaseStart[COUNTER_COUNT];
+  // The instruction currently executing, charged at the next dispatch.
+  bool pending;
+  OpcodeClass pendingClass;
+  uint64_t pendingStart[COUNTER_COUNT];
+} Counters;
+
+void initCounters(Counters* counters, bool byOpcode);
+void freeCounters(Counters* counters);
+void beginPhase(Counters* counters);
+void endPhase(Counters* counters, Phase phase);
+void countInstruction(Counters* counters, uint8_t instruction);
+void endInstructionCounts(Counters* counters);
+void printCounters(Counters* counters, FILE* out);
+
+#endif
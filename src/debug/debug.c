@@ -8,6 +8,41 @@ static int simpleInstruction(const char* name, int offset) {
   return offset + 1;
 }
 
+// A quickened instruction, shown with the one it stands in for.
+static int quickenedInstruction(const char* name, OpCode original,
+                                int offset) {
+  printf("%-16s (%s)\n", name, opInfo[original].name);
+  return offset + 1;
+}
+
+static int byteInstruction(const char* name, Chunk* chunk, int offset) {
+  uint8_t slot = chunk->code[offset + 1];
+  printf("%-16s %4d\n", name, slot);
+  return offset + 2;
+}
+
+static int jumpInstruction(const char* name, Chunk* chunk, int offset) {
+  printf("%-16s %4d -> %d\n", name, offset, jumpTarget(chunk, offset));
+  return offset + 3;
+}
+
+static int globalInstruction(const char* name, Chunk* chunk, int offset) {
+  uint8_t slot = chunk->code[offset + 1];
+  printf("%-16s %4d '", name, slot);
+  printValue(chunk->globals.values[slot]);
+  printf("'\n");
+  return offset + 2;
+}
+
+static int propertyInstruction(const char* name, Chunk* chunk, int offset) {
+  uint8_t* operand = &chunk->code[offset + 1];
+  int site = (operand[0] << 8) | operand[1];
+  printf("%-16s %4d '", name, site);
+  printValue(chunk->properties.values[site]);
+  printf("'\n");
+  return offset + 3;
+}
+
 static int constantInstruction(const char* name, Chunk* chunk, int offset) {
   uint8_t constant = chunk->code[offset + 1];
   printf("%-16s %4d '", name, constant);
@@ -16,23 +51,72 @@ static int constantInstruction(const char* name, Chunk* chunk, int offset) {
   return offset + 2;
 }
 
+static int constantShortInstruction(const char* name, Chunk* chunk,
+                                    int offset) {
+  uint8_t* operand = &chunk->code[offset + 1];
+  int constant = (operand[0] << 8) | operand[1];
+  printf("%-16s %4d '", name, constant);
+  printValue(chunk->constants.values[constant]);
+  printf("'\n");
+  return offset + 3;
+}
+
+static int constantLongInstruction(const char* name, Chunk* chunk,
+                                   int offset) {
+  uint8_t* operand = &chunk->code[offset + 1];
+  int constant = (operand[0] << 16) | (operand[1] << 8) | operand[2];
+  printf("%-16s %4d '", name, constant);
+  printValue(chunk->constants.values[constant]);
+  printf("'\n");
+  return offset + 4;
+}
+
 int disassembleInstruction(Chunk* chunk, int offset) {
   printf("%04d ", offset);
-  if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+  int line = getLine(chunk, offset);
+  if (offset > 0 && line == getLine(chunk, offset - 1)) {
     printf("   | ");
   } else {
-    printf("%4d ", chunk->lines[offset]);
+    printf("%4d ", line);
   }
-  uint8_t instruction = chunk->code[offset];
+  uint8_t instruction = loadOpcode(&chunk->code[offset]);
   switch (instruction) {
     case OP_CONSTANT:
       return constantInstruction("OP_CONSTANT", chunk, offset);
+    case OP_CONSTANT_LONG:
+      return constantLongInstruction("OP_CONSTANT_LONG", chunk, offset);
     case OP_NIL:
       return simpleInstruction("OP_NIL", offset);
     case OP_TRUE:
       return simpleInstruction("OP_TRUE", offset);
     case OP_FALSE:
       return simpleInstruction("OP_FALSE", offset);
+    case OP_GET_INPUT:
+      return byteInstruction("OP_GET_INPUT", chunk, offset);
+    case OP_GET_GLOBAL:
+      return globalInstruction("OP_GET_GLOBAL", chunk, offset);
+    case OP_SET_GLOBAL:
+      return globalInstruction("OP_SET_GLOBAL", chunk, offset);
+    case OP_POP:
+      return simpleInstruction("OP_POP", offset);
+    case OP_GET_LOCAL:
+      return byteInstruction("OP_GET_LOCAL", chunk, offset);
+    case OP_SET_LOCAL:
+      return byteInstruction("OP_SET_LOCAL", chunk, offset);
+    case OP_POPN:
+      return byteInstruction("OP_POPN", chunk, offset);
+    case OP_FOR_RANGE:
+      return jumpInstruction("OP_FOR_RANGE", chunk, offset);
+    case OP_FOR_LOOP:
+      return jumpInstruction("OP_FOR_LOOP", chunk, offset);
+    case OP_CLASS:
+      return constantShortInstruction("OP_CLASS", chunk, offset);
+    case OP_CALL:
+      return byteInstruction("OP_CALL", chunk, offset);
+    case OP_GET_PROPERTY:
+      return propertyInstruction("OP_GET_PROPERTY", chunk, offset);
+    case OP_SET_PROPERTY:
+      return propertyInstruction("OP_SET_PROPERTY", chunk, offset);
     case OP_EQUAL:
       return simpleInstruction("OP_EQUAL", offset);
     case OP_GREATER:
@@ -53,6 +137,30 @@ int disassembleInstruction(Chunk* chunk, int offset) {
       return simpleInstruction("OP_NEGATE", offset);
     case OP_RETURN:
       return simpleInstruction("OP_RETURN", offset);
+    case OP_NOT_EQUAL:
+      return simpleInstruction("OP_NOT_EQUAL", offset);
+    case OP_GREATER_EQUAL:
+      return simpleInstruction("OP_GREATER_EQUAL", offset);
+    case OP_LESS_EQUAL:
+      return simpleInstruction("OP_LESS_EQUAL", offset);
+    case OP_ADD_CONST:
+      return constantInstruction("OP_ADD_CONST", chunk, offset);
+    case OP_SUBTRACT_CONST:
+      return constantInstruction("OP_SUBTRACT_CONST", chunk, offset);
+    case OP_MULTIPLY_CONST:
+      return constantInstruction("OP_MULTIPLY_CONST", chunk, offset);
+    case OP_DIVIDE_CONST:
+      return constantInstruction("OP_DIVIDE_CONST", chunk, offset);
+    case OP_ADD_NUM:
+    case OP_SUBTRACT_NUM:
+    case OP_MULTIPLY_NUM:
+    case OP_DIVIDE_NUM:
+    case OP_GREATER_NUM:
+    case OP_LESS_NUM:
+    case OP_GREATER_EQUAL_NUM:
+    case OP_LESS_EQUAL_NUM:
+      return quickenedInstruction(opInfo[instruction].name,
+                                  unquickened(instruction), offset);
     default:
       printf("Unknown opcode %d\n", instruction);
       return offset + 1;
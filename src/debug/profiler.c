@@ -0,0 +1,145 @@
+#include "profiler.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "memory.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TICK_UNIT "cycles"
+
+static inline uint64_t readTicks() { return __rdtsc(); }
+#else
+#define TICK_UNIT "ns"
+
+static inline uint64_t readTicks() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+#endif
+
+void initProfile(Profile* profile) {
+  for (int i = 0; i <= UINT8_MAX; i++) {
+    profile->opcodes[i].count = 0;
+    profile->opcodes[i].ticks = 0;
+  }
+  profile->lines = NULL;
+  profile->lineCapacity = 0;
+  profile->pending = false;
+}
+
+void freeProfile(Profile* profile) {
+  FREE_ARRAY(ProfileEntry, profile->lines, profile->lineCapacity);
+  initProfile(profile);
+}
+
+static void charge(Profile* profile, uint64_t now) {
+  uint64_t ticks = now - profile->pendingStart;
+
+  ProfileEntry* opcode = &profile->opcodes[profile->pendingOpcode];
+  opcode->count++;
+  opcode->ticks += ticks;
+
+  if (profile->pendingLine >= profile->lineCapacity) {
+    int oldCapacity = profile->lineCapacity;
+    profile->lineCapacity = GROW_CAPACITY(oldCapacity);
+    while (profile->pendingLine >= profile->lineCapacity) {
+      profile->lineCapacity *= 2;
+    }
+    profile->lines = GROW_ARRAY(ProfileEntry, profile->lines, oldCapacity,
+                                profile->lineCapacity);
+    for (int i = oldCapacity; i < profile->lineCapacity; i++) {
+      profile->lines[i].count = 0;
+      profile->lines[i].ticks = 0;
+    }
+  }
+
+  ProfileEntry* line = &profile->lines[profile->pendingLine];
+  line->count++;
+  line->ticks += ticks;
+}
+
+void profileInstruction(Profile* profile, Chunk* chunk, int offset) {
+  uint64_t now = readTicks();
+  if (profile->pending) charge(profile, now);
+
+  profile->pending = true;
+  profile->pendingOpcode = loadOpcode(&chunk->code[offset]);
+  profile->pendingLine = getLine(chunk, offset);
+  // Start the clock after the bookkeeping so it isn't charged to the opcode.
+  profile->pendingStart = readTicks();
+}
+
+void endProfile(Profile* profile) {
+  if (!profile->pending) return;
+  charge(profile, readTicks());
+  profile->pending = false;
+}
+
+typedef struct {
+  int key;
+  ProfileEntry entry;
+} Row;
+
+static int compareRows(const void* a, const void* b) {
+  uint64_t ticksA = ((const Row*)a)->entry.ticks;
+  uint64_t ticksB = ((const Row*)b)->entry.ticks;
+  if (ticksA != ticksB) return ticksA < ticksB ? 1 : -1;
+  return ((const Row*)a)->key - ((const Row*)b)->key;
+}
+
+// Sorts the non-empty entries by time spent, most expensive first.
+static int sortedRows(ProfileEntry* entries, int count, Row* rows,
+                      uint64_t* totalTicks) {
+  int rowCount = 0;
+  *totalTicks = 0;
+  for (int i = 0; i < count; i++) {
+    if (entries[i].count == 0) continue;
+    rows[rowCount].key = i;
+    rows[rowCount].entry = entries[i];
+    rowCount++;
+    *totalTicks += entries[i].ticks;
+  }
+  qsort(rows, rowCount, sizeof(Row), compareRows);
+  return rowCount;
+}
+
+static void printRow(FILE* out, const char* label, ProfileEntry* entry,
+                     uint64_t totalTicks) {
+  double percent =
+      totalTicks == 0 ? 0 : 100.0 * (double)entry->ticks / (double)totalTicks;
+  fprintf(out, "%-20s %12llu %14llu %10.1f %6.1f%%\n", label,
+          (unsigned long long)entry->count, (unsigned long long)entry->ticks,
+          (double)entry->ticks / (double)entry->count, percent);
+}
+
+void printProfile(Profile* profile, FILE* out) {
+  uint64_t totalTicks;
+  Row opcodeRows[UINT8_MAX + 1];
+  int opcodeCount =
+      sortedRows(profile->opcodes, UINT8_MAX + 1, opcodeRows, &totalTicks);
+
+  fprintf(out, "== profile by opcode ==\n");
+  fprintf(out, "%-20s %12s %14s %10s %7s\n", "opcode", "count", TICK_UNIT,
+          "per exec", "share");
+  for (int i = 0; i < opcodeCount; i++) {
+    const char* name = opInfo[opcodeRows[i].key].name;
+    printRow(out, name != NULL ? name : "?", &opcodeRows[i].entry, totalTicks);
+  }
+
+  Row* lineRows = ALLOCATE(Row, profile->lineCapacity);
+  int lineCount =
+      sortedRows(profile->lines, profile->lineCapacity, lineRows, &totalTicks);
+
+  fprintf(out, "== profile by line ==\n");
+  fprintf(out, "%-20s %12s %14s %10s %7s\n", "line", "count", TICK_UNIT,
+          "per exec", "share");
+  for (int i = 0; i < lineCount; i++) {
+    char label[16];
+    snprintf(label, sizeof(label), "%d", lineRows[i].key);
+    printRow(out, label, &lineRows[i].entry, totalTicks);
+  }
+  FREE_ARRAY(Row, lineRows, profile->lineCapacity);
+}
@@ -0,0 +1,35 @@
+#ifndef BYTE_PROFILER_H
+#define BYTE_PROFILER_H
+
+#include <stdio.h>
+
+#include "core/chunk.h"
+
+// Execution count and accumulated time for one opcode or one source line.
+typedef struct {
+  uint64_t count;
+  uint64_t ticks;
+} ProfileEntry;
+
+// Filled in by the instrumented copy of run(). Each instruction is charged
+// the ticks from its dispatch to the next one, so handler time and dispatch
+// overhead are both included.
+typedef struct {
+  ProfileEntry opcodes[UINT8_MAX + 1];
+  ProfileEntry* lines;  // Indexed by source line.
+  int lineCapacity;
+
+  // The instruction currently executing, charged at the next dispatch.
+  bool pending;
+  uint8_t pendingOpcode;
+  int pendingLine;
+  uint64_t pendingStart;
+} Profile;
+
+void initProfile(Profile* profile);
+void freeProfile(Profile* profile);
+void profileInstruction(Profile* profile, Chunk* chunk, int offset);
+void endProfile(Profile* profile);
+void printProfile(Profile* profile, FILE* out);
+
+#endif
@@ -1,11 +1,17 @@
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "compiler/compiler.h"
 #include "compiler/vm.h"
+#include "core/bytecode.h"
 #include "core/common.h"
+#include "debug/counters.h"
+#include "debug/profiler.h"
 
-static void repl() {
+static void repl(VM* vm) {
   printf("Byte v%d.%d.%d\n", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH);
 
   char line[1024];
@@ -25,16 +31,17 @@ static void repl() {
       printf("exit - Exit the program\n");
     }
 
-    interpret(line);
+    interpretLine(vm, line);
   }
 }
 
+// Returns NULL after reporting the problem if the file cannot be read.
 static char* readFile(const char* path) {
   FILE* file = fopen(path, "rb");
 
   if (file == NULL) {
     fprintf(stderr, "Could not open file \"%s\".\n", path);
-    exit(74);
+    return NULL;
   }
 
   fseek(file, 0L, SEEK_END);
@@ -45,13 +52,16 @@ static char* readFile(const char* path) {
 
   if (buffer == NULL) {
     fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-    exit(74);
+    fclose(file);
+    return NULL;
   }
 
   size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
   if (bytesRead < fileSize) {
     fprintf(stderr, "Could not read file \"%s\".\n", path);
-    exit(74);
+    free(buffer);
+    fclose(file);
+    return NULL;
   }
 
   buffer[bytesRead] = '\0';
@@ -60,25 +70,222 @@ static char* readFile(const char* path) {
   return buffer;
 }
 
-static void runFile(const char* path) {
+static bool hasSuffix(const char* string, const char* suffix) {
+  size_t length = strlen(string);
+  size_t suffixLength = strlen(suffix);
+  return length >= suffixLength &&
+         strcmp(string + length - suffixLength, suffix) == 0;
+}
+
+// foo.byte caches to foo.bytec, anything else gets .bytec appended.
+static char* cachePathFor(const char* path) {
+  size_t length = strlen(path);
+  char* cachePath = (char*)malloc(length + 7);
+  if (hasSuffix(path, ".byte")) {
+    sprintf(cachePath, "%sc", path);
+  } else {
+    sprintf(cachePath, "%s.bytec", path);
+  }
+  return cachePath;
+}
+
+// The process exit status for a script that finished with `result`.
+static int exitStatus(InterpretResult result) {
+  switch (result) {
+    case INTERPRET_COMPILE_ERROR:
+      return 65;
+    case INTERPRET_RUNTIME_ERROR:
+      return 70;
+    default:
+      return 0;
+  }
+}
+
+static int runBytecodeFile(VM* vm, const char* path) {
+  BytecodeFile file;
+  if (!loadBytecode(&file, path)) {
+    fprintf(stderr, "Could not load bytecode file \"%s\".\n", path);
+    return 74;
+  }
+
+  InterpretResult result = interpretChunk(vm, &file.chunk);
+  unloadBytecode(&file);
+  return exitStatus(result);
+}
+
+// Reuses the cache file next to the script while its source hash matches and
+// refreshes it otherwise. Failing to write the cache is not an error.
+static int runSourceFile(VM* vm, const char* path) {
   char* source = readFile(path);
-  InterpretResult result = interpret(source);
+  if (source == NULL) return 74;
+
+  uint64_t sourceHash = hashSource(source, strlen(source));
+  char* cachePath = cachePathFor(path);
+
+  BytecodeFile file;
+  if (loadBytecode(&file, cachePath)) {
+    if (file.sourceHash == sourceHash) {
+      free(source);
+      free(cachePath);
+      InterpretResult result = interpretChunk(vm, &file.chunk);
+      unloadBytecode(&file);
+      return exitStatus(result);
+    }
+    unloadBytecode(&file);
+  }
+
+  Chunk chunk;
+  initChunk(&chunk);
+  InterpretResult result = INTERPRET_COMPILE_ERROR;
+  if (compileSource(vm, source, &chunk, NULL)) {
+    writeBytecode(&chunk, sourceHash, cachePath);
+    result = interpretChunk(vm, &chunk);
+  }
+
+  freeChunk(&chunk);
   free(source);  // [owner]
+  free(cachePath);
+  return exitStatus(result);
+}
 
-  if (result == INTERPRET_COMPILE_ERROR) exit(65);
-  if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+// Runs a script or, for a .bytec path, a compiled chunk. Returns the exit
+// status the process should end with.
+static int runFile(VM* vm, const char* path) {
+  if (hasSuffix(path, ".bytec")) return runBytecodeFile(vm, path);
+  return runSourceFile(vm, path);
+}
+
+typedef struct {
+  const char** paths;
+  int count;
+  atomic_int next;  // Index of the next path a worker should claim.
+  int* statuses;    // Exit status of each path, filled in by the workers.
+} Jobs;
+
+// Each worker owns one VM and keeps claiming scripts until none are left.
+static void* runJobs(void* arg) {
+  Jobs* jobs = (Jobs*)arg;
+  VM* vm = newVM();
+
+  for (;;) {
+    int job = atomic_fetch_add(&jobs->next, 1);
+    if (job >= jobs->count) break;
+    jobs->statuses[job] = runFile(vm, jobs->paths[job]);
+  }
+
+  freeVM(vm);
+  return NULL;
+}
+
+// Runs every script on a pool of `threadCount` threads and returns the
+// highest exit status any of them produced.
+static int runFiles(int threadCount, const char** paths, int count) {
+  if (threadCount > count) threadCount = count;
+
+  Jobs jobs;
+  jobs.paths = paths;
+  jobs.count = count;
+  atomic_init(&jobs.next, 0);
+  jobs.statuses = (int*)calloc(count, sizeof(int));
+
+  pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * threadCount);
+  int started = 0;
+  while (started < threadCount &&
+         pthread_create(&threads[started], NULL, runJobs, &jobs) == 0) {
+    started++;
+  }
+  // If no thread could be started, do the work on this one.
+  if (started == 0) runJobs(&jobs);
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  int status = 0;
+  for (int i = 0; i < count; i++) {
+    if (jobs.statuses[i] > status) status = jobs.statuses[i];
+  }
+
+  free(threads);
+  free(jobs.statuses);
+  return status;
+}
+
+static void compileFile(const char* path, const char* outPath) {
+  char* source = readFile(path);
+  if (source == NULL) exit(74);
+
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(source, &chunk)) exit(65);
+
+  if (!writeBytecode(&chunk, hashSource(source, strlen(source)), outPath)) {
+    fprintf(stderr, "Could not write file \"%s\".\n", outPath);
+    exit(74);
+  }
+
+  freeChunk(&chunk);
+  free(source);
+}
+
+static Profile profile;
+
+// Registered with atexit() so the report is printed on error exits too.
+static void reportProfile() {
+  printProfile(&profile, stderr);
+  freeProfile(&profile);
+}
+
+static Counters counters;
+
+static void reportCounters() {
+  printCounters(&counters, stderr);
+  freeCounters(&counters);
+}
+
+static void usage() {
+  fprintf(stderr, "Usage: byte [--profile] [--counters[=opcodes]] [path]\n");
+  fprintf(stderr, "       byte --compile <path> <out.bytec>\n");
+  fprintf(stderr, "       byte --jobs <threads> <path>...\n");
+  exit(64);
 }
 
 int main(int argc, const char* argv[]) {
-  initVM();
+  if (argc >= 4 && strcmp(argv[1], "--jobs") == 0) {
+    int threadCount = atoi(argv[2]);
+    if (threadCount < 1) usage();
+    return runFiles(threadCount, &argv[3], argc - 3);
+  }
+
+  VM* vm = newVM();
+
+  // Instrumentation options come first and apply to the REPL or one script.
+  while (argc >= 2) {
+    if (strcmp(argv[1], "--profile") == 0) {
+      initProfile(&profile);
+      setProfile(vm, &profile);
+      atexit(reportProfile);
+    } else if (strcmp(argv[1], "--counters") == 0 ||
+               strcmp(argv[1], "--counters=opcodes") == 0) {
+      initCounters(&counters, strcmp(argv[1], "--counters") != 0);
+      setCounters(vm, &counters);
+      atexit(reportCounters);
+    } else {
+      break;
+    }
+    argc--;
+    argv++;
+  }
+
+  int status = 0;
   if (argc == 1) {
-    repl();
+    repl(vm);
   } else if (argc == 2) {
-    runFile(argv[1]);
+    status = runFile(vm, argv[1]);
+  } else if (argc == 4 && strcmp(argv[1], "--compile") == 0) {
+    compileFile(argv[2], argv[3]);
   } else {
-    fprintf(stderr, "Usage: byte <path>\n");
-    exit(64);
+    usage();
   }
-  freeVM();
-  return 0;
+  freeVM(vm);
+  return status;
 }
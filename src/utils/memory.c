@@ -1,5 +1,21 @@
 #include "memory.h"
+
+#include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vm.h"
+
+#define GC_HEAP_GROW_FACTOR 2
+#define GC_MIN_HEAP (1024 * 1024)
+// While a sweep is pending, each allocation first sweeps this many objects
+// for every 64 bytes it asks for, so the sweep keeps pace with allocation.
+#define SWEEP_STEP 4
+
+// Keeps every object 8-byte aligned in the nursery.
+#define ALIGN_OBJECT(size) (((size) + 7) & ~(size_t)7)
 
 void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
   if (newSize == 0) {
@@ -9,4 +25,483 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
 
   void* result = realloc(pointer, newSize);
   return result;
-}
\ No newline at end of file
+}
+
+void initHeap(Heap* heap) {
+  heap->nursery = NULL;
+  heap->nurseryTop = NULL;
+  heap->nurseryEnd = NULL;
+  heap->objects = NULL;
+  heap->unswept = NULL;
+  heap->bytesAllocated = 0;
+  heap->nextGC = GC_MIN_HEAP;
+  heap->remembered = NULL;
+  heap->rememberedCount = 0;
+  heap->rememberedCapacity = 0;
+  initTable(&heap->strings);
+  heap->promoted = NULL;
+  heap->promotedCount = 0;
+  heap->promotedCapacity = 0;
+  heap->grayStack = NULL;
+  heap->grayCount = 0;
+  heap->grayCapacity = 0;
+  heap->concurrent = false;
+  heap->marking = false;
+  heap->markerDone = false;
+  heap->markBit = true;
+  heap->snapshot = NULL;
+  heap->snapshotCount = 0;
+  heap->snapshotCapacity = 0;
+  heap->satb = NULL;
+  heap->satbCount = 0;
+  heap->satbCapacity = 0;
+  heap->minorCollections = 0;
+  heap->majorCollections = 0;
+  heap->recordPauses = false;
+  heap->pauses = NULL;
+  heap->pauseCount = 0;
+  heap->pauseCapacity = 0;
+}
+
+static void freeObjects(Obj* object) {
+  while (object != NULL) {
+    Obj* next = object->next;
+    reallocate(object, objectSize(object), 0);
+    object = next;
+  }
+}
+
+void freeHeap(Heap* heap) {
+  if (heap->marking) pthread_join(heap->marker, NULL);
+  // Before the keys it looks at are freed.
+  clearInternedStrings(&heap->strings);
+  freeObjects(heap->objects);
+  freeObjects(heap->unswept);
+
+  FREE_ARRAY(uint8_t, heap->nursery, NURSERY_SIZE);
+  FREE_ARRAY(Obj*, heap->remembered, heap->rememberedCapacity);
+  freeTable(&heap->strings);
+  FREE_ARRAY(Obj*, heap->promoted, heap->promotedCapacity);
+  FREE_ARRAY(Obj*, heap->grayStack, heap->grayCapacity);
+  FREE_ARRAY(Value, heap->snapshot, heap->snapshotCapacity);
+  FREE_ARRAY(Obj*, heap->satb, heap->satbCapacity);
+  FREE_ARRAY(uint64_t, heap->pauses, heap->pauseCapacity);
+  initHeap(heap);
+}
+
+// Appends object to one of the heap's object stacks.
+static void pushObject(Obj*** stack, int* count, int* capacity, Obj* object) {
+  if (*capacity < *count + 1) {
+    int oldCapacity = *capacity;
+    *capacity = GROW_CAPACITY(oldCapacity);
+    *stack = GROW_ARRAY(Obj*, *stack, oldCapacity, *capacity);
+  }
+  (*stack)[(*count)++] = object;
+}
+
+void rememberObject(Heap* heap, Obj* object) {
+  pushObject(&heap->remembered, &heap->rememberedCount,
+             &heap->rememberedCapacity, object);
+  object->isRemembered = true;
+}
+
+// Records an old object the marker might otherwise miss, for the pause that
+// finishes marking.
+void shadeObject(Heap* heap, Obj* object) {
+  pushObject(&heap->satb, &heap->satbCount, &heap->satbCapacity, object);
+}
+
+// An object is marked when its isMarked equals the heap's markBit, which
+// flips at the start of each marking so nothing has to be unmarked. The
+// marker thread reads mark bits the mutator sets on promoted objects.
+static bool isMarked(Heap* heap, Obj* object) {
+  return __atomic_load_n(&object->isMarked, __ATOMIC_RELAXED) ==
+         heap->markBit;
+}
+
+static void setMarked(Heap* heap, Obj* object) {
+  __atomic_store_n(&object->isMarked, heap->markBit, __ATOMIC_RELAXED);
+}
+
+// Calls visit() on an object held by pointer rather than as a value, and
+// returns where the object is now.
+static Obj* visitPointer(Heap* heap, Obj* object,
+                         void (*visit)(Heap*, Value*)) {
+  if (object == NULL) return NULL;
+  Value value = OBJ_VAL(object);
+  visit(heap, &value);
+  return AS_OBJ(value);
+}
+
+// Calls visit() on every field of object that refers to another object.
+// Names are permanent and shapes are not objects, so neither is visited.
+static void visitReferences(Heap* heap, Obj* object,
+                            void (*visit)(Heap*, Value*)) {
+  switch (object->type) {
+    case OBJ_FIELDS: {
+      ObjFields* fields = (ObjFields*)object;
+      for (int i = 0; i < fields->capacity; i++) {
+        visit(heap, &fields->values[i]);
+      }
+      break;
+    }
+    case OBJ_INSTANCE: {
+      // The pointers are only written when promote() moved what they point
+      // to. The marker thread moves nothing, and the VM may be replacing
+      // fields while it looks.
+      ObjInstance* instance = (ObjInstance*)object;
+      Obj* klass = (Obj*)__atomic_load_n(&instance->klass, __ATOMIC_ACQUIRE);
+      Obj* moved = visitPointer(heap, klass, visit);
+      if (moved != klass) {
+        __atomic_store_n(&instance->klass, (ObjClass*)moved, __ATOMIC_RELEASE);
+      }
+      Obj* fields = (Obj*)__atomic_load_n(&instance->fields, __ATOMIC_ACQUIRE);
+      moved = visitPointer(heap, fields, visit);
+      if (moved != fields) {
+        __atomic_store_n(&instance->fields, (ObjFields*)moved,
+                         __ATOMIC_RELEASE);
+      }
+      break;
+    }
+    case OBJ_CLASS:
+    case OBJ_STRING:
+      break;
+  }
+}
+
+static uint64_t nanoseconds(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t)time.tv_sec * 1000000000u + (uint64_t)time.tv_nsec;
+}
+
+static void recordPause(Heap* heap, uint64_t start) {
+  uint64_t pause = nanoseconds() - start;
+  if (heap->pauseCapacity < heap->pauseCount + 1) {
+    int oldCapacity = heap->pauseCapacity;
+    heap->pauseCapacity = GROW_CAPACITY(oldCapacity);
+    heap->pauses =
+        GROW_ARRAY(uint64_t, heap->pauses, oldCapacity, heap->pauseCapacity);
+  }
+  heap->pauses[heap->pauseCount++] = pause;
+}
+
+// Frees up to count unmarked objects from the pending sweep and moves the
+// marked ones back to the old generation.
+static void sweepSome(Heap* heap, int count) {
+  while (heap->unswept != NULL && count-- > 0) {
+    Obj* object = heap->unswept;
+    heap->unswept = object->next;
+    if (isMarked(heap, object)) {
+      object->next = heap->objects;
+      heap->objects = object;
+      continue;
+    }
+
+    size_t size = objectSize(object);
+    heap->bytesAllocated -= ALIGN_OBJECT(size);
+    reallocate(object, size, 0);
+  }
+
+  if (heap->unswept == NULL) {
+    heap->nextGC = heap->bytesAllocated * GC_HEAP_GROW_FACTOR;
+    if (heap->nextGC < GC_MIN_HEAP) heap->nextGC = GC_MIN_HEAP;
+  }
+}
+
+static void finishSweeping(Heap* heap) {
+  if (heap->unswept != NULL) sweepSome(heap, INT_MAX);
+}
+
+// Objects allocated while marking runs are marked, since the marker only
+// looks for what was reachable when it started. Ones allocated later are
+// not swept, and the next marking flips markBit under them.
+static Obj* allocateOld(Heap* heap, size_t size) {
+  Obj* object = (Obj*)reallocate(NULL, 0, size);
+  object->isMarked = heap->markBit;
+  object->next = heap->objects;
+  heap->objects = object;
+  heap->bytesAllocated += ALIGN_OBJECT(size);
+  return object;
+}
+
+// Points slot at the old copy of the young object it refers to, copying the
+// object the first time it is reached.
+static void promote(Heap* heap, Value* slot) {
+  if (!IS_OBJ(*slot)) return;
+  // Most roots point outside the nursery. Telling by the address saves
+  // touching the object.
+  Obj* object = AS_OBJ(*slot);
+  uint8_t* address = (uint8_t*)object;
+  if (address < heap->nursery || address >= heap->nurseryEnd) return;
+  if (object->generation == GEN_FORWARDED) {
+    storeSlot(slot, OBJ_VAL(object->next));
+    return;
+  }
+  if (object->generation != GEN_YOUNG) return;
+
+  size_t size = objectSize(object);
+  Obj* copy = allocateOld(heap, size);
+  Obj header = *copy;
+  memcpy(copy, object, size);
+  copy->generation = GEN_OLD;
+  copy->isMarked = header.isMarked;
+  copy->next = header.next;
+
+  object->generation = GEN_FORWARDED;
+  object->next = copy;
+  storeSlot(slot, OBJ_VAL(copy));
+  // Its own fields may still point into the nursery.
+  pushObject(&heap->promoted, &heap->promotedCount, &heap->promotedCapacity,
+             copy);
+}
+
+// Where the interned string key is now that the survivors have been
+// promoted, or EMPTY_VAL if it died young.
+static Value promotedKey(void* heap, Value key) {
+  (void)heap;
+  Obj* object = AS_OBJ(key);
+  if (object->generation == GEN_FORWARDED) return OBJ_VAL(object->next);
+  if (object->generation == GEN_YOUNG) return EMPTY_VAL;
+  return key;
+}
+
+// Copies the young objects reachable from the stack, the globals and the
+// remembered objects into the old generation, then empties the nursery.
+// Constants are permanent, so the constant pools need not be traced.
+static void minorCollection(VM* vm) {
+  Heap* heap = &vm->heap;
+#ifdef DEBUG_LOG_GC
+  size_t before = heap->bytesAllocated;
+#endif
+
+  for (Value* slot = vm->stack; slot < vm->stackTop; slot++) {
+    promote(heap, slot);
+  }
+  for (int i = 0; i < vm->globalCount; i++) {
+    promote(heap, &vm->globals[i]);
+  }
+  for (int i = 0; i < heap->rememberedCount; i++) {
+    heap->remembered[i]->isRemembered = false;
+    visitReferences(heap, heap->remembered[i], promote);
+  }
+  heap->rememberedCount = 0;
+  while (heap->promotedCount > 0) {
+    visitReferences(heap, heap->promoted[--heap->promotedCount], promote);
+  }
+
+  tableRelocateKeys(&heap->strings, promotedKey, heap);
+  heap->nurseryTop = heap->nursery;
+  heap->minorCollections++;
+
+#ifdef DEBUG_LOG_GC
+  printf("-- gc minor: promoted %zu bytes\n", heap->bytesAllocated - before);
+#endif
+}
+
+// Marks the old object slot refers to. The marker thread calls this too, so
+// it must not look inside young objects, which the mutator moves and
+// overwrites.
+static void markValue(Heap* heap, Value* slot) {
+  Value value = loadSlot(slot);
+  if (!IS_OBJ(value)) return;
+  Obj* object = AS_OBJ(value);
+  uint8_t* address = (uint8_t*)object;
+  if (address >= heap->nursery && address < heap->nurseryEnd) return;
+  if (object->generation != GEN_OLD || isMarked(heap, object)) return;
+
+  setMarked(heap, object);
+  pushObject(&heap->grayStack, &heap->grayCount, &heap->grayCapacity, object);
+}
+
+static void traceReferences(Heap* heap) {
+  while (heap->grayCount > 0) {
+    visitReferences(heap, heap->grayStack[--heap->grayCount], markValue);
+  }
+}
+
+// EMPTY_VAL if the interned string key is about to be swept.
+static Value markedKey(void* heap, Value key) {
+  Obj* object = AS_OBJ(key);
+  if (object->generation == GEN_OLD && !isMarked(heap, object)) {
+    return EMPTY_VAL;
+  }
+  return key;
+}
+
+// Queues the whole old generation for sweeping, once marking is done.
+static void beginSweep(Heap* heap) {
+  tableRelocateKeys(&heap->strings, markedKey, heap);
+  heap->unswept = heap->objects;
+  heap->objects = NULL;
+  heap->majorCollections++;
+}
+
+// Marks the old generation from the roots and frees what was not reached.
+// Runs right after a minor collection, when the nursery is empty and nothing
+// needs to be remembered.
+static void majorCollection(VM* vm) {
+  Heap* heap = &vm->heap;
+#ifdef DEBUG_LOG_GC
+  size_t before = heap->bytesAllocated;
+#endif
+
+  finishSweeping(heap);
+  heap->markBit = !heap->markBit;
+  for (Value* slot = vm->stack; slot < vm->stackTop; slot++) {
+    markValue(heap, slot);
+  }
+  for (int i = 0; i < vm->globalCount; i++) {
+    markValue(heap, &vm->globals[i]);
+  }
+  traceReferences(heap);
+  beginSweep(heap);
+  finishSweeping(heap);
+
+#ifdef DEBUG_LOG_GC
+  printf("-- gc major: freed %zu bytes, next at %zu\n",
+         before - heap->bytesAllocated, heap->nextGC);
+#endif
+}
+
+static void* markInBackground(void* argument) {
+  Heap* heap = (Heap*)argument;
+  for (int i = 0; i < heap->snapshotCount; i++) {
+    markValue(heap, &heap->snapshot[i]);
+  }
+  traceReferences(heap);
+  __atomic_store_n(&heap->markerDone, true, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+// Snapshots the stack and the globals and hands them to a new marker thread.
+// Marks on this thread instead if the thread cannot be started.
+static void startMarking(VM* vm) {
+  Heap* heap = &vm->heap;
+  finishSweeping(heap);
+
+  int stackCount = (int)(vm->stackTop - vm->stack);
+  int count = stackCount + vm->globalCount;
+  if (heap->snapshotCapacity < count) {
+    heap->snapshot =
+        GROW_ARRAY(Value, heap->snapshot, heap->snapshotCapacity, count);
+    heap->snapshotCapacity = count;
+  }
+  memcpy(heap->snapshot, vm->stack, sizeof(Value) * (size_t)stackCount);
+  if (vm->globalCount > 0) {
+    memcpy(heap->snapshot + stackCount, vm->globals,
+           sizeof(Value) * (size_t)vm->globalCount);
+  }
+  heap->snapshotCount = count;
+
+  heap->markBit = !heap->markBit;
+  heap->markerDone = false;
+  heap->marking = true;
+  if (pthread_create(&heap->marker, NULL, markInBackground, heap) != 0) {
+    heap->marking = false;
+    majorCollection(vm);
+  }
+#ifdef DEBUG_LOG_GC
+  printf("-- gc started marking %d roots\n", count);
+#endif
+}
+
+// Waits for the marker, then marks what the write barrier recorded meanwhile
+// and starts sweeping. Runs right after a minor collection.
+static void finishMarking(Heap* heap) {
+  pthread_join(heap->marker, NULL);
+  heap->marking = false;
+
+  for (int i = 0; i < heap->satbCount; i++) {
+    Value value = OBJ_VAL(heap->satb[i]);
+    markValue(heap, &value);
+  }
+  heap->satbCount = 0;
+  traceReferences(heap);
+  beginSweep(heap);
+#ifdef DEBUG_LOG_GC
+  printf("-- gc finished marking\n");
+#endif
+}
+
+// Waits for a marking still in progress and finishes it. Called as each run
+// ends: the marker looks at the strings old objects refer to, and the chunk
+// owning those that are constants may be freed once its run is over.
+void endMarking(VM* vm) {
+  Heap* heap = &vm->heap;
+  if (!heap->marking) return;
+
+  uint64_t start = heap->recordPauses ? nanoseconds() : 0;
+  finishMarking(heap);
+  if (heap->recordPauses) recordPause(heap, start);
+}
+
+// Runs a minor collection, then a major one if asked to or if the old
+// generation has outgrown nextGC. In concurrent mode a major collection
+// that was not asked for only starts or finishes marking.
+void collectGarbage(VM* vm, bool major) {
+  Heap* heap = &vm->heap;
+  uint64_t start = heap->recordPauses ? nanoseconds() : 0;
+
+  minorCollection(vm);
+  // Past this the VM waits for the collector rather than keep growing.
+  bool overgrown = heap->bytesAllocated > heap->nextGC * GC_HEAP_GROW_FACTOR;
+  if (heap->marking) {
+    if (major || overgrown ||
+        __atomic_load_n(&heap->markerDone, __ATOMIC_ACQUIRE)) {
+      finishMarking(heap);
+    }
+    if (major) majorCollection(vm);
+  } else if (major || (!heap->concurrent &&
+                       heap->bytesAllocated > heap->nextGC)) {
+    majorCollection(vm);
+  } else if (heap->bytesAllocated > heap->nextGC &&
+             (heap->unswept == NULL || overgrown)) {
+    startMarking(vm);
+  }
+
+  if (heap->recordPauses) recordPause(heap, start);
+}
+
+// Returns a new object of size bytes on vm's heap with its header filled in.
+// Usually a pointer bump; may collect first.
+Obj* allocateObject(VM* vm, size_t size, ObjType type) {
+  Heap* heap = &vm->heap;
+  size = ALIGN_OBJECT(size);
+  if (heap->nursery == NULL) {
+    heap->nursery = ALLOCATE(uint8_t, NURSERY_SIZE);
+    heap->nurseryTop = heap->nursery;
+    heap->nurseryEnd = heap->nursery + NURSERY_SIZE;
+  }
+
+  // Sweeping is paid for a little at a time by the allocations after it.
+  if (heap->unswept != NULL) {
+    sweepSome(heap, SWEEP_STEP * (int)(size / 64 + 1));
+  }
+
+  Obj* object;
+  if (size > LARGE_OBJECT) {
+    if (heap->bytesAllocated + size > heap->nextGC) {
+      collectGarbage(vm, !heap->concurrent);
+    }
+    object = allocateOld(heap, size);
+    object->generation = GEN_OLD;
+  } else {
+#ifdef DEBUG_STRESS_GC
+    collectGarbage(vm, !heap->concurrent);
+#else
+    if (size > (size_t)(heap->nurseryEnd - heap->nurseryTop)) {
+      collectGarbage(vm, false);
+    }
+#endif
+    object = (Obj*)heap->nurseryTop;
+    heap->nurseryTop += size;
+    object->generation = GEN_YOUNG;
+    object->isMarked = false;
+    object->next = NULL;
+  }
+
+  object->type = type;
+  object->isRemembered = false;
+  return object;
+}
@@ -1,7 +1,11 @@
 #ifndef BYTE_MEMORY_H
 #define BYTE_MEMORY_H
 
+#include <pthread.h>
+
 #include "core/common.h"
+#include "core/object.h"
+#include "core/table.h"
 
 #define ALLOCATE(type, count) (type*)reallocate(NULL, 0, sizeof(type) * (count))
 
@@ -16,6 +20,129 @@
 #define FREE_ARRAY(type, pointer, oldCount) \
   reallocate(pointer, sizeof(type) * (oldCount), 0)
 
+// Young objects are bump-allocated from the nursery. Anything bigger than
+// LARGE_OBJECT goes straight to the old generation instead of being copied.
+#define NURSERY_SIZE (256 * 1024)
+#define LARGE_OBJECT (NURSERY_SIZE / 8)
+
+typedef struct VM VM;
+
+// The objects one VM creates while running. Each VM collects its own heap on
+// its own thread: its objects are reachable only from its stack and its
+// globals, and what it shares with other VMs, the constants of the chunks it
+// runs, is permanent.
+//
+// Objects start in the nursery. A minor collection copies the survivors into
+// the old generation, a list of separately allocated objects, and resets the
+// nursery. Once the old generation has grown past nextGC, a major collection
+// marks it from the roots and sweeps the rest.
+//
+// With concurrent set, major collections mark on a background thread while
+// the VM keeps running. A pause takes a snapshot of the roots and starts the
+// marker; once it is done, the next minor collection finishes marking what
+// the write barrier recorded in the meantime, or the end of the run if that
+// comes first. Objects promoted until then are marked already. Unreached
+// objects are then swept a few at a time by the allocations that follow.
+typedef struct {
+  uint8_t* nursery;  // NULL until the first allocation.
+  uint8_t* nurseryTop;
+  uint8_t* nurseryEnd;
+
+  Obj* objects;           // The old generation, newest first.
+  Obj* unswept;           // Old objects still to be swept.
+  size_t bytesAllocated;  // By the old generation.
+  size_t nextGC;
+
+  // Old objects that may point into the nursery, found by writeBarrier().
+  Obj** remembered;
+  int rememberedCount;
+  int rememberedCapacity;
+
+  // The strings this VM has interned, see finishString(). Weak: collections
+  // move and drop the keys rather than trace them.
+  Table strings;
+
+  // Copies made by a minor collection whose fields are still to be scanned.
+  Obj** promoted;
+  int promotedCount;
+  int promotedCapacity;
+
+  // Marked objects whose references are still to be traced. Owned by the
+  // marker thread while concurrent marking runs.
+  Obj** grayStack;
+  int grayCount;
+  int grayCapacity;
+
+  bool concurrent;
+  bool markBit;     // The isMarked of marked objects, see isMarked().
+  bool marking;     // From starting the marker until the marking is finished.
+  bool markerDone;  // Set by the marker thread when it runs out of work.
+  pthread_t marker;
+  // The stack and the globals when marking started.
+  Value* snapshot;
+  int snapshotCount;
+  int snapshotCapacity;
+  // Old objects the write barrier saw dropped while marking ran.
+  Obj** satb;
+  int satbCount;
+  int satbCapacity;
+
+  uint64_t minorCollections;
+  uint64_t majorCollections;
+  // The length of every pause, in nanoseconds, when recordPauses is set.
+  bool recordPauses;
+  uint64_t* pauses;
+  int pauseCount;
+  int pauseCapacity;
+} Heap;
+
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
 
+void initHeap(Heap* heap);
+void freeHeap(Heap* heap);
+Obj* allocateObject(VM* vm, size_t size, ObjType type);
+void collectGarbage(VM* vm, bool major);
+void endMarking(VM* vm);
+void rememberObject(Heap* heap, Obj* object);
+void shadeObject(Heap* heap, Obj* object);
+
+// The marker thread reads the references in old objects while the VM writes
+// them, so field values, and the class and field array of an instance, are
+// written and read through these or the same __atomic operations. The
+// release store also makes the header of the object stored visible to the
+// marker along with the reference. Concurrent marking needs values that fit
+// in one atomic word, so it is only available with NaN boxing.
+static inline Value loadSlot(Value* slot) {
+#ifdef BYTE_NAN_BOXING
+  return __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+#else
+  return *slot;
+#endif
+}
+
+static inline void storeSlot(Value* slot, Value value) {
+#ifdef BYTE_NAN_BOXING
+  __atomic_store_n(slot, value, __ATOMIC_RELEASE);
+#else
+  *slot = value;
+#endif
+}
+
+// Call before storing value into *field, a field of object. Minor
+// collections trace only from the roots and the remembered objects, so an
+// old object that comes to point into the nursery has to be remembered.
+// While marking runs, the reference being overwritten is recorded so the
+// marker still sees everything reachable when it started.
+static inline void writeBarrier(Heap* heap, Obj* object, Value* field,
+                                Value value) {
+  if (heap->marking && IS_OBJ(*field) &&
+      AS_OBJ(*field)->generation == GEN_OLD) {
+    shadeObject(heap, AS_OBJ(*field));
+  }
+  if (object->generation == GEN_OLD && !object->isRemembered &&
+      IS_OBJ(value) && AS_OBJ(value)->generation == GEN_YOUNG) {
+    rememberObject(heap, object);
+  }
+}
+
 #endif